@@ -0,0 +1,275 @@
+/*
+MIT License
+
+Copyright (c) 2017 CPirc
+Copyright (c) 2018 CPirc
+Copyright (c) 2019 CPirc
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "analyse.h"
+#include "move.h"
+#include "position.h"
+#include "search.h"
+
+/* The positions of a batch analysis and their results. */
+/* Workers take positions in order and the writer streams the results out */
+/* in the same order. */
+struct AnalyseJob {
+    std::vector<std::string> lines;
+    std::vector<std::string> results;
+    std::vector<char> done;
+    std::atomic<std::size_t> next;
+    std::mutex mutex;
+    std::condition_variable ready;
+};
+
+/* Split an EPD line into a FEN and its operations. */
+/* EPD has no move counters, but a FEN line is accepted as well. */
+bool epd_to_fen(const std::string& line, std::string& fen, std::string& ops) {
+    std::istringstream ss(line);
+    std::string fields[4];
+
+    for (auto& field : fields) {
+        if (!(ss >> field)) {
+            return false;
+        }
+    }
+
+    if (std::count(fields[0].begin(), fields[0].end(), '/') != 7 ||
+        (fields[1] != "w" && fields[1] != "b")) {
+        return false;
+    }
+
+    fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3];
+
+    std::string halfmoves, fullmoves;
+    std::streampos after_position = ss.tellg();
+    if (ss >> halfmoves >> fullmoves &&
+        halfmoves.find_first_not_of("0123456789") == std::string::npos &&
+        fullmoves.find_first_not_of("0123456789") == std::string::npos) {
+        fen += " " + halfmoves + " " + fullmoves;
+    } else {
+        fen += " 0 1";
+        ss.clear();
+        ss.seekg(after_position);
+    }
+
+    std::getline(ss, ops);
+    return true;
+}
+
+/* Get the id operation of an EPD line, if it has one. */
+static std::string epd_id(const std::string& ops) {
+    std::size_t start = ops.find("id ");
+    if (start == std::string::npos ||
+        (start > 0 && ops[start - 1] != ' ' && ops[start - 1] != ';')) {
+        return "";
+    }
+
+    std::size_t end = ops.find(';', start);
+    return " " + ops.substr(start, end == std::string::npos
+                                       ? std::string::npos
+                                       : end - start + 1);
+}
+
+/* Can the position be searched? */
+static bool position_valid(const Position& pos) {
+    return popcnt(get_piece(pos, KING, WHITE)) == 1 &&
+           popcnt(get_piece(pos, KING, BLACK)) == 1 &&
+           !is_checked(pos, ~pos.side);
+}
+
+/* Search one EPD line and format the result as EPD operations. */
+static std::string analyse_line(SearchController& sc,
+                                const std::string& line) {
+    std::string fen, ops;
+    if (!epd_to_fen(line, fen, ops)) {
+        return line + " ; c0 \"invalid position\";";
+    }
+
+    parse_fen_to_position(fen.c_str(), sc.pos);
+    if (!position_valid(sc.pos)) {
+        return line + " ; c0 \"invalid position\";";
+    }
+    history_reset(sc.history, sc.pos);
+
+    SearchResult result;
+    sc.stopped = false;
+    search_position(sc, result);
+
+    std::ostringstream out;
+    out << fen.substr(0, fen.rfind(' ', fen.rfind(' ') - 1));
+
+    char mstr[6];
+    if (result.pv.empty()) {
+        out << " bm 0000;";
+    } else {
+        move_to_lan(mstr, result.pv[0]);
+        out << " bm " << mstr << ";";
+    }
+
+    if (result.score > INF - MAX_PLY) {
+        out << " dm " << (INF - result.score + 1) / 2 << ";";
+    } else if (result.score < -INF + MAX_PLY) {
+        out << " dm " << -(result.score + INF) / 2 << ";";
+    } else {
+        out << " ce " << result.score << ";";
+    }
+
+    out << " acd " << result.depth << "; acn " << result.nodes << ";";
+
+    if (!result.pv.empty()) {
+        out << " pv";
+        for (Move move : result.pv) {
+            move_to_lan(mstr, move);
+            out << " " << mstr;
+        }
+        out << ";";
+    }
+
+    out << epd_id(ops);
+    return out.str();
+}
+
+/* Search positions of the job until there are none left. */
+static void analyse_worker(AnalyseJob& job, const AnalyseOptions& options,
+                           TT* tt) {
+    SearchController sc;
+
+    sc.max_depth = options.depth ? options.depth + 1 : MAX_PLY;
+    sc.max_nodes = options.nodes;
+    sc.moves_per_session = 0;
+    sc.increment = 0;
+    sc.our_clock = 0;
+    sc.movetime = 0;
+    sc.infinite = !options.movetime;
+    sc.silent = true;
+    sc.tt = tt;
+
+    // A whole movetime for one move to go, rather than UCI's half.
+    if (options.movetime) {
+        sc.moves_per_session = 1;
+        sc.our_clock = options.movetime;
+    }
+
+    std::size_t i;
+    while ((i = job.next++) < job.lines.size()) {
+        if (!options.shared_tt) {
+            tt_new_search(tt);
+        }
+
+        std::string result = analyse_line(sc, job.lines[i]);
+
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.results[i] = std::move(result);
+        job.done[i] = true;
+        job.ready.notify_one();
+    }
+}
+
+/* Analyse every position of an EPD file, writing the results in order. */
+bool analyse(const char* epd_path, const char* out_path,
+             const AnalyseOptions& options, TT* shared_tt,
+             std::size_t& count) {
+    assert(epd_path);
+    assert(out_path);
+    assert(options.threads > 0);
+    assert(options.depth || options.nodes || options.movetime);
+
+    std::ifstream in(epd_path);
+    if (!in) {
+        return false;
+    }
+
+    std::ofstream out(out_path);
+    if (!out) {
+        return false;
+    }
+
+    AnalyseJob job;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") != std::string::npos) {
+            if (line.back() == '\r') line.pop_back();
+            job.lines.push_back(line);
+        }
+    }
+    job.results.resize(job.lines.size());
+    job.done.assign(job.lines.size(), false);
+    job.next = 0;
+
+    // Each worker gets a slice of the hash, unless they share a table.
+    std::vector<TT> tables(options.shared_tt ? 0 : options.threads);
+    if (options.shared_tt) {
+        tt_wait(shared_tt);
+        tt_new_search(shared_tt);
+    } else {
+        std::uint64_t megabytes = options.megabytes / options.threads;
+        for (TT& tt : tables) {
+            if (!tt_create(&tt, megabytes ? megabytes : 1)) {
+                for (TT& created : tables) tt_free(&created);
+                return false;
+            }
+            tt_clear(&tt);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options.threads; ++i) {
+        TT* tt = options.shared_tt ? shared_tt : &tables[i];
+        workers.emplace_back(analyse_worker, std::ref(job), std::cref(options),
+                             tt);
+    }
+
+    // Stream the results out as soon as the ones before them are done.
+    for (std::size_t i = 0; i < job.lines.size(); ++i) {
+        std::string result;
+        {
+            std::unique_lock<std::mutex> lock(job.mutex);
+            job.ready.wait(lock, [&job, i] { return job.done[i] != 0; });
+            result.swap(job.results[i]);
+        }
+        out << result << '\n';
+        out.flush();
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (TT& tt : tables) {
+        tt_free(&tt);
+    }
+
+    count = job.lines.size();
+    return bool(out);
+}
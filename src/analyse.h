@@ -0,0 +1,51 @@
+/*
+MIT License
+
+Copyright (c) 2017 CPirc
+Copyright (c) 2018 CPirc
+Copyright (c) 2019 CPirc
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef ANALYSE_H
+#define ANALYSE_H
+
+#include <cstddef>
+#include <string>
+
+#include "tt.h"
+
+/* Limits and table settings of a batch analysis. */
+struct AnalyseOptions {
+    std::uint32_t depth;      // Depth limit, or 0 for none.
+    std::uint64_t nodes;      // Node limit, or 0 for none.
+    std::int64_t movetime;    // Milliseconds per position, or 0 for none.
+    int threads;              // Number of workers.
+    bool shared_tt;           // Share one table rather than one per worker.
+    std::uint64_t megabytes;  // Total size of the private tables.
+};
+
+extern bool epd_to_fen(const std::string& line, std::string& fen,
+                       std::string& ops);
+extern bool analyse(const char* epd_path, const char* out_path,
+                    const AnalyseOptions& options, TT* shared_tt,
+                    std::size_t& count);
+
+#endif
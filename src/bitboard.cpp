@@ -31,55 +31,208 @@
 #include "bitboard.h"
 #include "types.h"
 
-std::uint64_t pawn_mask[2][64];
-std::uint64_t knight_mask[64];
-std::uint64_t king_mask[64];
+/* File and rank steps of the slider directions, the first four of which */
+/* go towards higher squares */
+static constexpr int slider_steps[8][2] = {{0, 1},  {1, 1},   {1, 0},
+                                           {-1, 1}, {0, -1},  {-1, -1},
+                                           {-1, 0}, {1, -1}};
 
-void init_bitboards() {
-    initmagicmoves();
+/* Rays from each square to the edge of the board */
+static constexpr Table<Table<std::uint64_t, 64>, 8> make_rays() {
+    Table<Table<std::uint64_t, 64>, 8> rays{};
+    for (int dir = 0; dir < 8; dir++) {
+        for (int sq = A1; sq <= H8; sq++) {
+            const int df = slider_steps[dir][0], dr = slider_steps[dir][1];
+            int f = sq % 8 + df, r = sq / 8 + dr;
+            while (f >= 0 && f < 8 && r >= 0 && r < 8) {
+                rays[dir][sq] |= 1ULL << (8 * r + f);
+                f += df;
+                r += dr;
+            }
+        }
+    }
+    return rays;
+}
 
-    // Pawns
-    for (int sq = A1; sq <= H8; sq++) {
-        std::uint64_t from = 1ULL << sq;
-        pawn_mask[US][sq] = ((from << 7) & ~file_mask[FILE_H]) |
-                            ((from << 9) & ~file_mask[FILE_A]);
-        pawn_mask[THEM][sq] = ((from >> 7) & ~file_mask[FILE_A]) |
-                              ((from >> 9) & ~file_mask[FILE_H]);
+static constexpr Table<Table<std::uint64_t, 64>, 8> rays = make_rays();
+
+/* Get the squares a slider attacks in one direction by cutting its ray off */
+/* behind the nearest blocker. This is cheap enough to evaluate every slider */
+/* table at compile time, more so for indexing the rays directly. */
+static constexpr std::uint64_t ray_attacks(const int sq,
+                                           const std::uint64_t occ,
+                                           const int dir) {
+    const std::uint64_t* ray = rays.data[dir].data;
+    const std::uint64_t blockers = ray[sq] & occ;
+    if (!blockers) {
+        return ray[sq];
     }
+    const int blocker =
+        dir < 4 ? __builtin_ctzll(blockers) : 63 - __builtin_clzll(blockers);
+    return ray[sq] ^ ray[blocker];
+}
+
+static constexpr std::uint64_t slow_bishop_attacks(const int sq,
+                                                   const std::uint64_t occ) {
+    return ray_attacks(sq, occ, 1) | ray_attacks(sq, occ, 3) |
+           ray_attacks(sq, occ, 5) | ray_attacks(sq, occ, 7);
+}
+
+static constexpr std::uint64_t slow_rook_attacks(const int sq,
+                                                 const std::uint64_t occ) {
+    return ray_attacks(sq, occ, 0) | ray_attacks(sq, occ, 2) |
+           ray_attacks(sq, occ, 4) | ray_attacks(sq, occ, 6);
+}
 
-    // Knights
+/* Get the squares a leaper attacks, dropping steps that leave the board. */
+template <int N>
+static constexpr std::uint64_t leaper_attacks(const int sq,
+                                              const int (&steps)[N][2]) {
+    std::uint64_t attacks = 0;
+    for (int i = 0; i < N; i++) {
+        const int f = sq % 8 + steps[i][0], r = sq / 8 + steps[i][1];
+        if (f >= 0 && f < 8 && r >= 0 && r < 8) {
+            attacks |= 1ULL << (8 * r + f);
+        }
+    }
+    return attacks;
+}
+
+/* File and rank steps of the leapers */
+static constexpr int white_pawn_steps[2][2] = {{-1, 1}, {1, 1}};
+static constexpr int black_pawn_steps[2][2] = {{-1, -1}, {1, -1}};
+static constexpr int knight_steps[8][2] = {{1, 2},   {2, 1},  {2, -1},
+                                           {1, -2},  {-1, -2}, {-2, -1},
+                                           {-2, 1},  {-1, 2}};
+static constexpr int king_steps[8][2] = {{0, 1},  {1, 1},   {1, 0},
+                                         {1, -1}, {0, -1},  {-1, -1},
+                                         {-1, 0}, {-1, 1}};
+
+template <int N>
+static constexpr Table<std::uint64_t, 64> make_leaper_masks(
+    const int (&steps)[N][2]) {
+    Table<std::uint64_t, 64> masks{};
     for (int sq = A1; sq <= H8; sq++) {
-        std::uint64_t from = 1ULL << sq;
-        knight_mask[sq] = (from >> 17) & (~file_mask[FILE_H]);   // Up 2 right 1
-        knight_mask[sq] |= (from >> 15) & (~file_mask[FILE_A]);  // Up 2 left 1
-        knight_mask[sq] |=
-            (from << 17) & (~file_mask[FILE_A]);  // Down 2 left 1
-        knight_mask[sq] |=
-            (from << 15) & (~file_mask[FILE_H]);  // Down 2 right 1
-        knight_mask[sq] |= (from >> 10) & ~(file_mask[FILE_G] |
-                                            file_mask[FILE_H]);  // Right 2 up 1
-        knight_mask[sq] |=
-            (from << 6) &
-            ~(file_mask[FILE_G] | file_mask[FILE_H]);  // Right 2 down 1
-        knight_mask[sq] |= (from >> 6) & ~(file_mask[FILE_A] |
-                                           file_mask[FILE_B]);  // Left 2 up 1
-        knight_mask[sq] |= (from << 10) & ~(file_mask[FILE_A] |
-                                            file_mask[FILE_B]);  // Left 2 up 1
-        knight_mask[sq] |=
-            (from << 10) &
-            ~(file_mask[FILE_A] | file_mask[FILE_B]);  // Left 2 down 1
+        masks[sq] = leaper_attacks(sq, steps);
+    }
+    return masks;
+}
+
+static constexpr Table<Table<std::uint64_t, 64>, 64> make_between_masks() {
+    Table<Table<std::uint64_t, 64>, 64> between{};
+    for (int a = A1; a <= H8; a++) {
+        for (int b = A1; b <= H8; b++) {
+            const std::uint64_t bit_a = 1ULL << a, bit_b = 1ULL << b;
+
+            if (slow_rook_attacks(a, 0) & bit_b) {
+                between[a][b] = slow_rook_attacks(a, bit_b) &
+                                slow_rook_attacks(b, bit_a);
+            } else if (slow_bishop_attacks(a, 0) & bit_b) {
+                between[a][b] = slow_bishop_attacks(a, bit_b) &
+                                slow_bishop_attacks(b, bit_a);
+            }
+        }
     }
+    return between;
+}
+
+constexpr Table<Table<std::uint64_t, 64>, 2> pawn_mask = {
+    {make_leaper_masks(white_pawn_steps), make_leaper_masks(black_pawn_steps)}};
+constexpr Table<std::uint64_t, 64> knight_mask =
+    make_leaper_masks(knight_steps);
+constexpr Table<std::uint64_t, 64> king_mask = make_leaper_masks(king_steps);
+constexpr Table<Table<std::uint64_t, 64>, 64> between_mask =
+    make_between_masks();
+
+#if defined(USE_PEXT)
+/* Get the squares whose occupancy can change a slider's attacks. */
+static constexpr std::uint64_t slider_mask(const int sq, const bool bishop) {
+    const std::uint64_t edges = rank_mask[RANK_1] | rank_mask[RANK_8] |
+                                file_mask[FILE_A] | file_mask[FILE_H];
+    if (bishop) {
+        return slow_bishop_attacks(sq, 0) & ~edges;
+    }
+    return ((rays[2][sq] | rays[6][sq]) &
+            ~(file_mask[FILE_A] | file_mask[FILE_H])) |
+           ((rays[0][sq] | rays[4][sq]) &
+            ~(rank_mask[RANK_1] | rank_mask[RANK_8]));
+}
 
-    // Kings
+/* Get the size of the PEXT attacks of the sliders on a rank. */
+static constexpr int pext_size(const bool bishop, const int rank) {
+    int size = 0;
+    for (int sq = 8 * rank; sq < 8 * rank + 8; sq++) {
+        size += 1 << __builtin_popcountll(slider_mask(sq, bishop));
+    }
+    return size;
+}
+
+/* Fill the PEXT attacks of the sliders on a rank with one attack set per */
+/* subset of each square's mask. The carry-rippler walks the subsets of a */
+/* mask in the order of their PEXT index, so the index is simply a counter. */
+template <int N>
+static constexpr Table<std::uint64_t, N> make_pext_attacks(const bool bishop,
+                                                           const int rank) {
+    Table<std::uint64_t, N> attacks{};
+    int index = 0;
+    for (int sq = 8 * rank; sq < 8 * rank + 8; sq++) {
+        const std::uint64_t mask = slider_mask(sq, bishop);
+        std::uint64_t subset = 0;
+        do {
+            attacks[index++] = bishop ? slow_bishop_attacks(sq, subset)
+                                      : slow_rook_attacks(sq, subset);
+            subset = (subset - mask) & mask;
+        } while (subset);
+    }
+    return attacks;
+}
+
+/* Each rank is a separate constant expression, which keeps the work of */
+/* evaluating one within the compiler's limits. */
+template <bool bishop, int rank>
+static constexpr Table<std::uint64_t, pext_size(bishop, rank)> pext_attacks =
+    make_pext_attacks<pext_size(bishop, rank)>(bishop, rank);
+
+/* Point each square at its attacks, in the order they were filled. */
+template <bool bishop>
+static constexpr Table<PextTable, 64> make_pext_tables() {
+    const std::uint64_t* const ranks[8] = {
+        pext_attacks<bishop, 0>.data, pext_attacks<bishop, 1>.data,
+        pext_attacks<bishop, 2>.data, pext_attacks<bishop, 3>.data,
+        pext_attacks<bishop, 4>.data, pext_attacks<bishop, 5>.data,
+        pext_attacks<bishop, 6>.data, pext_attacks<bishop, 7>.data};
+    Table<PextTable, 64> tables{};
+    const std::uint64_t* next = ranks[0];
     for (int sq = A1; sq <= H8; sq++) {
-        std::uint64_t from = 1ULL << sq;
-        king_mask[sq] = (from >> 8);                          // Up 1
-        king_mask[sq] |= (from << 8);                         // Down 1
-        king_mask[sq] |= (from >> 1) & (~file_mask[FILE_H]);  // Right 1
-        king_mask[sq] |= (from << 1) & (~file_mask[FILE_A]);  // Left 1
-        king_mask[sq] |= (from >> 7) & (~file_mask[FILE_A]);  // Up 1 Left 1
-        king_mask[sq] |= (from >> 9) & (~file_mask[FILE_H]);  // Up 1 Right 1
-        king_mask[sq] |= (from << 7) & (~file_mask[FILE_H]);  // Down 1 Right 1
-        king_mask[sq] |= (from << 9) & (~file_mask[FILE_A]);  // Down 1 Left 1
+        if (sq % 8 == 0) next = ranks[sq / 8];
+        tables[sq].attacks = next;
+        tables[sq].mask = slider_mask(sq, bishop);
+        next += 1 << __builtin_popcountll(tables[sq].mask);
     }
+    return tables;
+}
+
+constexpr Table<PextTable, 64> pext_bishop = make_pext_tables<true>();
+constexpr Table<PextTable, 64> pext_rook = make_pext_tables<false>();
+
+/* Does the CPU have BMI2, which the whole PEXT build is compiled for? */
+bool bmi2_supported() {
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+#else
+    return true;
+#endif
+}
+
+/* Is PEXT not microcoded, as it is on AMD before Zen 3? */
+bool pext_is_fast() {
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return !__builtin_cpu_is("amdfam15h") && !__builtin_cpu_is("znver1") &&
+           !__builtin_cpu_is("znver2");
+#else
+    return true;
+#endif
 }
+#endif
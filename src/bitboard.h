@@ -29,6 +29,10 @@ SOFTWARE.
 
 #include <cinttypes>
 
+#if defined(USE_PEXT)
+#include <immintrin.h>
+#endif
+
 #include "magic_moves.h"
 #include "types.h"
 
@@ -40,21 +44,24 @@ SOFTWARE.
     putchar('\n');
 
 /* Bitboard masks for ranks on a chessboard. */
-static const std::uint64_t rank_mask[8] = {
+static constexpr std::uint64_t rank_mask[8] = {
     0x00000000000000FFULL, 0x000000000000FF00ULL, 0x0000000000FF0000ULL,
     0x00000000FF000000ULL, 0x000000FF00000000ULL, 0x0000FF0000000000ULL,
     0x00FF000000000000ULL, 0xFF00000000000000ULL};
 
 /* Bitboard masks for files on a chessboard. */
-static const std::uint64_t file_mask[8] = {
+static constexpr std::uint64_t file_mask[8] = {
     0x0101010101010101ULL, 0x0202020202020202ULL, 0x0404040404040404ULL,
     0x0808080808080808ULL, 0x1010101010101010ULL, 0x2020202020202020ULL,
     0x4040404040404040ULL, 0x8080808080808080ULL};
 
-/* Precalculated piece attacks for a square. */
-extern std::uint64_t pawn_mask[2][64];
-extern std::uint64_t knight_mask[64];
-extern std::uint64_t king_mask[64];
+/* Precalculated piece attacks for a square, generated at compile time. */
+extern const Table<Table<std::uint64_t, 64>, 2> pawn_mask;
+extern const Table<std::uint64_t, 64> knight_mask;
+extern const Table<std::uint64_t, 64> king_mask;
+
+/* Squares strictly between two squares on a rank, file or diagonal. */
+extern const Table<Table<std::uint64_t, 64>, 64> between_mask;
 
 #if defined(__GNUC__)
 /* Get least significant bit. */
@@ -92,6 +99,39 @@ inline int popcnt(std::uint64_t bb) { return __popcnt64(bb); }
 inline std::uint64_t bswap(std::uint64_t bb) { return _byteswap_uint64(bb); }
 #endif
 
+#if defined(USE_PEXT)
+/* Slider attacks indexed by the occupancy bits PEXT extracts from a mask. */
+struct PextTable {
+    const std::uint64_t* attacks;
+    std::uint64_t mask;
+};
+
+extern const Table<PextTable, 64> pext_bishop;
+extern const Table<PextTable, 64> pext_rook;
+
+/* Can this CPU run the PEXT build, and is PEXT fast on it? */
+extern bool bmi2_supported();
+extern bool pext_is_fast();
+#endif
+
+/* Get bishop attacks from a square. */
+inline std::uint64_t bishop_attacks(const Square sq, const std::uint64_t occ) {
+#if defined(USE_PEXT)
+    return pext_bishop[sq].attacks[_pext_u64(occ, pext_bishop[sq].mask)];
+#else
+    return Bmagic(sq, occ);
+#endif
+}
+
+/* Get rook attacks from a square. */
+inline std::uint64_t rook_attacks(const Square sq, const std::uint64_t occ) {
+#if defined(USE_PEXT)
+    return pext_rook[sq].attacks[_pext_u64(occ, pext_rook[sq].mask)];
+#else
+    return Rmagic(sq, occ);
+#endif
+}
+
 /* Get attacks for a piece. */
 template <Piece p>
 std::uint64_t attacks(const Square sq, const std::uint64_t occ) {
@@ -99,15 +139,15 @@ std::uint64_t attacks(const Square sq, const std::uint64_t occ) {
 
     switch (p) {
         case PAWN:
-            return pawn_mask[US][sq];
+            return pawn_mask[WHITE][sq];
         case KNIGHT:
             return knight_mask[sq];
         case BISHOP:
-            return Bmagic(sq, occ);
+            return bishop_attacks(sq, occ);
         case ROOK:
-            return Rmagic(sq, occ);
+            return rook_attacks(sq, occ);
         case QUEEN:
-            return Bmagic(sq, occ) | Rmagic(sq, occ);
+            return bishop_attacks(sq, occ) | rook_attacks(sq, occ);
         case KING:
             return king_mask[sq];
         case NO_PIECE:
@@ -115,11 +155,15 @@ std::uint64_t attacks(const Square sq, const std::uint64_t occ) {
     }
 }
 
+/* Shift a bitboard by a signed number of squares. */
+template <int d>
+inline std::uint64_t shift(const std::uint64_t bb) {
+    return d > 0 ? bb << (d & 63) : bb >> (-d & 63);
+}
+
 /* Get side-dependent pawn attacks. */
 inline std::uint64_t pawn_attacks(const Square sq, const Colour c) {
     return pawn_mask[c][sq];
 }
 
-extern void init_bitboards();
-
 #endif
@@ -0,0 +1,47 @@
+/*
+MIT License
+
+Copyright (c) 2017 CPirc
+Copyright (c) 2018 CPirc
+Copyright (c) 2019 CPirc
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <cstddef>
+
+#include "move.h"
+#include "position.h"
+
+/* A Polyglot opening book mapped into memory. */
+struct Book {
+    const unsigned char* data;  // 16-byte big-endian entries sorted by key.
+    std::size_t size;           // Number of entries.
+    std::size_t bytes;          // Size of the mapping.
+};
+
+extern bool book_open(Book* book, const char* path);
+extern void book_close(Book* book);
+extern std::uint64_t polyglot_key(const Position& pos);
+extern bool book_probe(const Book* book, const Position& pos, Move& move);
+
+#endif
@@ -24,114 +24,76 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <cassert>
 #include <cinttypes>
+#include <cstddef>
+#include <cstdlib>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "eval.h"
 #include "position.h"
 #include "psqt.h"
 #include "types.h"
 
-/* Piece values for material in centipawns. */
-const int piecevals[2][7] = {{100, 300, 300, 500, 900, 0, 0},
-                             {100, 300, 300, 500, 900, 0, 0}};
-
 /* Phase weights for material. */
 const int phase_weights[7] = {0, 1, 1, 2, 4, 0, 0};
 
-/* Mobility weights for material. */
-const int mobility_weights[7] = {0, 4, 4, 4, 4, 0, 0};
-
-/* Passed pawn advancement bonus. */
-const int passed_pawn_bonus[8] = {0, 0, 10, 20, 40, 80, 160, 0};
-
-/* Return material balance of a board. */
-/* TODO: incremental update this. */
-template <Piece p = PAWN>
-int evaluate_material(const Position& pos) {
-    return popcnt(get_piece(pos, p, US)) * piecevals[OPENING][p] +
-           evaluate_material<p + 1>(pos);
-}
-
-template <>
-inline int evaluate_material<QUEEN>(const Position& pos) {
-    return popcnt(get_piece(pos, QUEEN, US)) * piecevals[OPENING][QUEEN];
-}
-
-/* Return material phase of a board. */
-/* 24 = opening, 0 = endgame. */
-/* TODO: incremental update this. */
-template <Piece p = PAWN>
-int material_phase(const Position& pos) {
-    std::uint64_t pieces = get_piece(pos, p, US);
-
-    return (popcnt(pieces) * phase_weights[p]) +
-           (p == KING ? 0 : material_phase<p + 1>(pos));
-}
-
-/* PST values for the pieces on the board. */
-template <Phase ph, Piece p = PAWN>
-inline int evaluate_pst(const Position& pos) {
-    int score = 0;
-    uint64_t pieces = get_piece(pos, p, US);
-
-    while (pieces) {
-        score += pst[p][ph][lsb(pieces)];
-
-        pieces &= pieces - 1;
-    }
+/* Bonus for each friendly piece next to the king. */
+const int king_shelter = 5;
 
-    return score + evaluate_pst<ph, p + 1>(pos);
-}
+/* Most squares a piece attacks, on an empty board. */
+const int most_attacks[7] = {0, 8, 13, 14, 27, 0, 0};
 
-template <>
-inline int evaluate_pst<OPENING, KING>(const Position& pos) {
-    int score = 0;
-    uint64_t pieces = get_piece(pos, KING, US);
+/* Material and PST score of a piece on a square, seen from its colour. */
+Score piece_sq_scores[2][6][64];
 
-    while (pieces) {
-        score += pst[KING][OPENING][lsb(pieces)];
+/* Most the mobility of a piece can score with the current weights. */
+int mobility_bounds[7];
 
-        pieces &= pieces - 1;
+/* Fill in the material and PST scores, mirroring them for black, and the */
+/* mobility bounds the lazy evaluation uses. */
+void init_psq_scores() {
+    for (Piece p = PAWN; p <= KING; ++p) {
+        mobility_bounds[p] = most_attacks[p] * std::abs(mobility_weights[p]);
     }
 
-    return score;
-}
+    for (Piece p = PAWN; p <= KING; ++p) {
+        for (Square sq = A1; sq <= H8; ++sq) {
+            const Score score =
+                make_score(piecevals[OPENING][p] + pst[p][OPENING][sq],
+                           piecevals[ENDGAME][p] + pst[p][ENDGAME][sq]);
 
-template <>
-inline int evaluate_pst<ENDGAME, KING>(const Position& pos) {
-    int score = 0;
-    uint64_t pieces = get_piece(pos, KING, US);
-
-    while (pieces) {
-        score += pst[KING][ENDGAME][lsb(pieces)];
-
-        pieces &= pieces - 1;
+            piece_sq_scores[WHITE][p][sq] = score;
+            piece_sq_scores[BLACK][p][relative_square(BLACK, sq)] = score;
+        }
     }
-
-    return score;
 }
 
+template <Colour c>
 inline int king_safety(const Position& pos) {
-    std::uint64_t king_bb = get_piece(pos, KING, US);
+    std::uint64_t king_bb = get_piece(pos, KING, c);
     Square king_sq = lsb(king_bb);
     std::uint64_t surrounding = attacks<KING>(king_sq, (std::uint64_t)0);
 
     int score = 0;
 
     // Nearby friendly pieces
-    score += 5 * popcnt(surrounding & get_colour(pos, US));
+    score += king_shelter * popcnt(surrounding & get_colour(pos, c));
 
     // Nearby unfriendly pieces
-    // score -= 5*popcnt(surrounding & get_colour(pos, THEM));
+    // score -= 5*popcnt(surrounding & get_colour(pos, ~c));
 
     return score;
 }
 
-/* Evaluate piece mobility. */
-template <Piece p = KNIGHT>
+/* Evaluate the mobility of one kind of piece. */
+template <Colour c, Piece p>
 int evaluate_mobility(const Position& pos) {
     int score = 0;
-    uint64_t pieces = get_piece(pos, p, US);
+    uint64_t pieces = get_piece(pos, p, c);
 
     while (pieces) {
         score += popcnt(attacks<p>(lsb(pieces), get_occupancy(pos))) *
@@ -140,30 +102,26 @@ int evaluate_mobility(const Position& pos) {
         pieces &= pieces - 1;
     }
 
-    return score + evaluate_mobility<p + 1>(pos);
+    return score;
 }
 
-template <>
-int evaluate_mobility<QUEEN>(const Position& pos) {
-    int score = 0;
-    uint64_t pieces = get_piece(pos, QUEEN, US);
-
-    while (pieces) {
-        score += popcnt(attacks<QUEEN>(lsb(pieces), get_occupancy(pos))) *
-                 mobility_weights[QUEEN];
-
-        pieces &= pieces - 1;
-    }
-
-    return score;
+/* Evaluate piece mobility. */
+template <Colour c>
+int evaluate_mobility(const Position& pos) {
+    return evaluate_mobility<c, KNIGHT>(pos) +
+           evaluate_mobility<c, BISHOP>(pos) +
+           evaluate_mobility<c, ROOK>(pos) + evaluate_mobility<c, QUEEN>(pos);
 }
 
-inline int evaluate_passers(const Position& pos) {
+/* Find the passed pawns of a side and add up their advancement bonuses. */
+template <Colour c>
+inline int evaluate_passers(const Position& pos, std::uint64_t& passed) {
     int score = 0;
-    std::uint64_t pawns = get_piece(pos, PAWN, US);
+    std::uint64_t pawns = get_piece(pos, PAWN, c);
 
+    passed = 0;
     while (pawns) {
-        int sq = lsb(pawns);
+        int sq = relative_square(c, lsb(pawns));
         int rank = sq >> 3;
         int file = sq & 7;  // Do we have a macro for this?
 
@@ -179,8 +137,14 @@ inline int evaluate_passers(const Position& pos) {
             mask |= 0x0101010101010101ULL << (sq + 9);
         }
 
-        if (!(mask & get_piece(pos, PAWN, THEM))) {
+        // The mask was built from c's side of the board.
+        if (c == BLACK) {
+            mask = bswap(mask);
+        }
+
+        if (!(mask & get_piece(pos, PAWN, ~c))) {
             score += passed_pawn_bonus[rank];
+            passed |= 1ULL << lsb(pawns);
         }
 
         pawns &= pawns - 1;
@@ -189,33 +153,678 @@ inline int evaluate_passers(const Position& pos) {
     return score;
 }
 
-/* Return the heuristic value of a position. */
-int evaluate(Position& pos) {
+/* Evaluate the pawn structure into a pawn table entry. */
+static void evaluate_pawns(const Position& pos, PawnEntry& entry) {
+    const int score = evaluate_passers<WHITE>(pos, entry.passed[WHITE]) -
+                      evaluate_passers<BLACK>(pos, entry.passed[BLACK]);
+
+    entry.key = pos.pawn_key;
+    entry.opening = score;
+    entry.endgame = score;
+}
+
+/* Add the terms of a side to the opening and endgame scores. */
+/* Material, PST and the pawn structure are scored separately, see */
+/* evaluate_cheap(). */
+template <Colour c>
+inline void evaluate_side(const Position& pos, int& opening, int& endgame) {
+    // King safety
+    opening += king_safety<c>(pos);
+
+    opening += evaluate_mobility<c>(pos);
+    endgame += evaluate_mobility<c>(pos);
+}
+
+/* Add up the terms the position and the pawn table already have for the */
+/* side to move: material, PST and the pawn structure. */
+template <Colour US>
+inline void evaluate_cheap(const Position& pos, const PawnEntry& pawns,
+                           int& opening, int& endgame) {
+    constexpr Colour THEM = ~US;
+
+    // material + PST, kept up to date by the position
+    opening += opening_score(pos.psq[US]) - opening_score(pos.psq[THEM]);
+    endgame += endgame_score(pos.psq[US]) - endgame_score(pos.psq[THEM]);
+
+    // The pawn scores are from white's side
+    opening += US == WHITE ? pawns.opening : -pawns.opening;
+    endgame += US == WHITE ? pawns.endgame : -pawns.endgame;
+}
+
+/* Blend the opening and endgame scores by the phase of the side to move. */
+inline int taper(const Position& pos, const int opening, const int endgame) {
+    const int phase = pos.phase[pos.side];
+    return ((phase * opening) + ((24 - phase) * endgame)) / 24;
+}
+
+/* Return the heuristic value of a position for the side to move. */
+template <Colour US>
+int evaluate(const Position& pos, const PawnEntry& pawns) {
+    constexpr Colour THEM = ~US;
     int opening = 0, endgame = 0;
-    int phase = material_phase<>(pos);
-    Colour side;
+    int them_opening = 0, them_endgame = 0;
 
-    for (side = US; side <= THEM; ++side) {
-        // material + PST
-        opening += evaluate_material<>(pos) + evaluate_pst<OPENING>(pos);
-        endgame += evaluate_material<>(pos) + evaluate_pst<ENDGAME>(pos);
+    evaluate_cheap<US>(pos, pawns, opening, endgame);
+    evaluate_side<US>(pos, opening, endgame);
+    evaluate_side<THEM>(pos, them_opening, them_endgame);
 
-        // King safety
-        opening += king_safety(pos);
+    return taper(pos, opening - them_opening, endgame - them_endgame);
+}
 
-        opening += evaluate_mobility<>(pos);
-        endgame += evaluate_mobility<>(pos);
+/* Get the pawn table entry of a position, evaluating the structure if it */
+/* isn't there. */
+inline const PawnEntry& probe_pawns(const Position& pos, PawnTable& table) {
+    PawnEntry& pawns = table.entries[pos.pawn_key & (PAWN_TABLE_SIZE - 1)];
+    if (pawns.key != pos.pawn_key) {
+        evaluate_pawns(pos, pawns);
+    }
+    return pawns;
+}
+
+/* Evaluate a position, looking its pawn structure up in a pawn table. */
+int evaluate(const Position& pos, PawnTable& table) {
+    const PawnEntry& pawns = probe_pawns(pos, table);
 
-        // Passed pawns
-        opening += evaluate_passers(pos);
-        endgame += evaluate_passers(pos);
+    return pos.side == WHITE ? evaluate<WHITE>(pos, pawns)
+                             : evaluate<BLACK>(pos, pawns);
+}
 
-        opening = -opening;
-        endgame = -endgame;
-        flip_position(pos);
+/* Most the king safety and mobility of a side can move the tapered score */
+/* of a position either way, from the pieces it has. Mobility weights may */
+/* be negative. Phases above 24, which promotions allow, give the endgame */
+/* score a negative weight. */
+inline int lazy_margin(const Position& pos, const Colour c) {
+    int mobility = 0;
+    for (Piece p = KNIGHT; p <= QUEEN; ++p) {
+        mobility += popcnt(get_piece(pos, p, c)) * mobility_bounds[p];
     }
 
-    int score = ((phase * opening) + ((24 - phase) * endgame)) / 24;
+    const int phase = pos.phase[pos.side];
+    const int opening = 8 * king_shelter + mobility;
+    // Plus one for each score taper() rounds.
+    return (phase * opening + std::abs(24 - phase) * mobility) / 24 + 2;
+}
 
-    return score;
+/* Evaluate a position only as far as comparing it with a window needs. */
+/* If material, PST and pawns are far enough outside the window that */
+/* mobility and king safety can't bring them back in, that score is */
+/* returned and exact is false. Otherwise this is evaluate(). */
+int evaluate(const Position& pos, PawnTable& table, const int alpha,
+             const int beta, bool& exact) {
+    const PawnEntry& pawns = probe_pawns(pos, table);
+
+    int opening = 0, endgame = 0;
+    if (pos.side == WHITE) {
+        evaluate_cheap<WHITE>(pos, pawns, opening, endgame);
+    } else {
+        evaluate_cheap<BLACK>(pos, pawns, opening, endgame);
+    }
+
+    // Either side's terms may help or hurt either side.
+    const int score = taper(pos, opening, endgame);
+    const int margin = lazy_margin(pos, WHITE) + lazy_margin(pos, BLACK);
+    if (score - margin >= beta || score + margin <= alpha) {
+#ifndef NDEBUG
+        const int full = evaluate(pos);
+        assert(score >= beta ? full >= beta : full <= alpha);
+#endif
+        exact = false;
+        return score;
+    }
+
+    exact = true;
+    return pos.side == WHITE ? evaluate<WHITE>(pos, pawns)
+                             : evaluate<BLACK>(pos, pawns);
+}
+
+int evaluate(const Position& pos) {
+    PawnEntry pawns;
+    evaluate_pawns(pos, pawns);
+
+    return pos.side == WHITE ? evaluate<WHITE>(pos, pawns)
+                             : evaluate<BLACK>(pos, pawns);
+}
+
+/* Where the parameters of each kind start in the parameter vector */
+#define PARAM_MATERIAL (0)                        // [phase][pawn to queen]
+#define PARAM_PST (PARAM_MATERIAL + 2 * 5)        // [piece][phase][square]
+#define PARAM_MOBILITY (PARAM_PST + 2 * 6 * 64)  // [knight to queen]
+#define PARAM_PASSED (PARAM_MOBILITY + 4)         // [rank 2 to 7]
+
+/* List the tunable parameters in parameter vector order. */
+void eval_params(EvalParam* params) {
+    for (int phase = OPENING; phase <= ENDGAME; ++phase) {
+        for (int p = PAWN; p <= QUEEN; ++p) {
+            params[PARAM_MATERIAL + phase * 5 + p] = {
+                &piecevals[phase][p], ParamPhase(phase)};
+        }
+    }
+    for (int p = PAWN; p <= KING; ++p) {
+        for (int phase = OPENING; phase <= ENDGAME; ++phase) {
+            for (int sq = A1; sq <= H8; ++sq) {
+                params[PARAM_PST + (p * 2 + phase) * 64 + sq] = {
+                    &pst[p][phase][sq], ParamPhase(phase)};
+            }
+        }
+    }
+    for (int p = KNIGHT; p <= QUEEN; ++p) {
+        params[PARAM_MOBILITY + p - int(KNIGHT)] = {&mobility_weights[p],
+                                                    PARAM_BOTH};
+    }
+    for (int r = RANK_2; r <= RANK_7; ++r) {
+        params[PARAM_PASSED + r - int(RANK_2)] = {&passed_pawn_bonus[r],
+                                                  PARAM_BOTH};
+    }
+}
+
+/* Count the material, PST and mobility parameters of a kind of piece. */
+/* Indices are kept as int, as adding an int to a Square gives a Square. */
+template <Colour c, Piece p>
+inline void trace_pieces(const Position& pos, EvalTrace& trace) {
+    constexpr int sign = c == WHITE ? 1 : -1;
+    constexpr int piece = p;
+    std::uint64_t pieces = get_piece(pos, p, c);
+
+    while (pieces) {
+        const Square sq = lsb(pieces);
+        const int rsq = relative_square(c, sq);
+
+        if (p != KING) {
+            trace.coefficients[PARAM_MATERIAL + piece] += sign;
+            trace.coefficients[PARAM_MATERIAL + 5 + piece] += sign;
+        }
+        trace.coefficients[PARAM_PST + (piece * 2 + OPENING) * 64 + rsq] +=
+            sign;
+        trace.coefficients[PARAM_PST + (piece * 2 + ENDGAME) * 64 + rsq] +=
+            sign;
+        if (p != PAWN && p != KING) {
+            trace.coefficients[PARAM_MOBILITY + piece - int(KNIGHT)] +=
+                sign * popcnt(attacks<p>(sq, get_occupancy(pos)));
+        }
+
+        pieces &= pieces - 1;
+    }
+}
+
+/* Count the parameters of a side, following evaluate_side(). */
+template <Colour c>
+inline void trace_side(const Position& pos, EvalTrace& trace) {
+    constexpr int sign = c == WHITE ? 1 : -1;
+
+    trace_pieces<c, PAWN>(pos, trace);
+    trace_pieces<c, KNIGHT>(pos, trace);
+    trace_pieces<c, BISHOP>(pos, trace);
+    trace_pieces<c, ROOK>(pos, trace);
+    trace_pieces<c, QUEEN>(pos, trace);
+    trace_pieces<c, KING>(pos, trace);
+
+    std::uint64_t passed;
+    evaluate_passers<c>(pos, passed);
+    while (passed) {
+        const int rank = relative_square(c, lsb(passed)) >> 3;
+        trace.coefficients[PARAM_PASSED + rank - int(RANK_2)] += sign;
+        passed &= passed - 1;
+    }
+
+    trace.opening += sign * king_safety<c>(pos);
+}
+
+/* Break the evaluation of a position down by parameter. Tapering the */
+/* parameters weighted by their coefficients gives evaluate() from white's */
+/* side. */
+void evaluate_trace(const Position& pos, EvalTrace& trace) {
+    for (int i = 0; i < EVAL_PARAMS; ++i) {
+        trace.coefficients[i] = 0;
+    }
+    trace.opening = 0;
+    trace.endgame = 0;
+    trace.phase = pos.phase[pos.side];
+
+    trace_side<WHITE>(pos, trace);
+    trace_side<BLACK>(pos, trace);
+}
+
+/* Empty a batch, keeping its memory for the next positions. */
+void eval_batch_clear(EvalBatch& batch) {
+    for (int i = 0; i < 6; ++i) {
+        batch.pieces[i].clear();
+    }
+    for (int i = 0; i < 2; ++i) {
+        batch.colours[i].clear();
+        batch.psq[i].clear();
+    }
+    batch.phase.clear();
+    batch.side.clear();
+#ifndef NDEBUG
+    batch.expected.clear();
+#endif
+}
+
+/* Append a position to a batch. */
+void eval_batch_add(EvalBatch& batch, const Position& pos) {
+    for (int i = 0; i < 6; ++i) {
+        batch.pieces[i].push_back(pos.pieces[i]);
+    }
+    for (int i = 0; i < 2; ++i) {
+        batch.colours[i].push_back(pos.colours[i]);
+        batch.psq[i].push_back(pos.psq[i]);
+    }
+    batch.phase.push_back(pos.phase[pos.side]);
+    batch.side.push_back(pos.side);
+#ifndef NDEBUG
+    batch.expected.push_back(evaluate(pos));
+#endif
+}
+
+/* The batch evaluator computes the terms above with set-wise bitboard */
+/* operations instead of square by square. Every position is then the same */
+/* sequence of shifts, masks and popcounts, and a vector register holds */
+/* several of them. Material and PST come from the psq accumulators the */
+/* positions keep, so nothing has to be gathered from the tables. */
+
+/* The kernel is written once over the operations of a kind of lane, see */
+/* ScalarLanes, Avx2Lanes and Avx512Lanes. Those operations are compiled */
+/* for their instruction set, and the kernel is inlined into a function */
+/* compiled for the same set, where they are inlined in turn. */
+#if defined(__GNUC__)
+#define LANES_INLINE inline __attribute__((always_inline))
+#else
+#define LANES_INLINE inline
+#endif
+
+/* One position at a time, for CPUs without AVX2 and the end of a batch */
+struct ScalarLanes {
+    static constexpr int width = 1;
+    struct V {
+        std::uint64_t v;
+    };
+
+    static V load(const std::uint64_t* p) { return V{*p}; }
+    static V set(const std::uint64_t x) { return V{x}; }
+    template <int n>
+    static V shl(const V a) { return V{a.v << n}; }
+    template <int n>
+    static V shr(const V a) { return V{a.v >> n}; }
+    static V and_(const V a, const V b) { return V{a.v & b.v}; }
+    static V or_(const V a, const V b) { return V{a.v | b.v}; }
+    static V andnot(const V a, const V b) { return V{a.v & ~b.v}; }
+    static V popcount(const V a) { return V{std::uint64_t(popcnt(a.v))}; }
+    static V add(const V a, const V b) { return V{a.v + b.v}; }
+    static V sub(const V a, const V b) { return V{a.v - b.v}; }
+    static V mul(const V a, const int w) {
+        return V{a.v * std::uint64_t(std::int64_t(w))};
+    }
+    static void store(std::int64_t* p, const V a) { *p = a.v; }
+};
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define AVX2_LANES __attribute__((target("avx2")))
+#define AVX512_LANES __attribute__((target("avx512f,avx512vpopcntdq")))
+
+/* Four positions at a time */
+struct Avx2Lanes {
+    static constexpr int width = 4;
+    struct V {
+        __m256i v;
+    };
+
+    AVX2_LANES static V load(const std::uint64_t* p) {
+        return V{_mm256_loadu_si256((const __m256i*)p)};
+    }
+    AVX2_LANES static V set(const std::uint64_t x) {
+        return V{_mm256_set1_epi64x(x)};
+    }
+    template <int n>
+    AVX2_LANES static V shl(const V a) {
+        return V{_mm256_slli_epi64(a.v, n)};
+    }
+    template <int n>
+    AVX2_LANES static V shr(const V a) {
+        return V{_mm256_srli_epi64(a.v, n)};
+    }
+    AVX2_LANES static V and_(const V a, const V b) {
+        return V{_mm256_and_si256(a.v, b.v)};
+    }
+    AVX2_LANES static V or_(const V a, const V b) {
+        return V{_mm256_or_si256(a.v, b.v)};
+    }
+    AVX2_LANES static V andnot(const V a, const V b) {
+        return V{_mm256_andnot_si256(b.v, a.v)};
+    }
+    /* Look the count of each nibble up with a byte shuffle, and add the */
+    /* bytes of each lane with a sum of absolute differences from zero. */
+    AVX2_LANES static V popcount(const V a) {
+        const __m256i counts = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2,
+            2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i nibble = _mm256_set1_epi8(0x0F);
+        const __m256i low = _mm256_and_si256(a.v, nibble);
+        const __m256i high =
+            _mm256_and_si256(_mm256_srli_epi16(a.v, 4), nibble);
+        const __m256i bytes =
+            _mm256_add_epi8(_mm256_shuffle_epi8(counts, low),
+                            _mm256_shuffle_epi8(counts, high));
+        return V{_mm256_sad_epu8(bytes, _mm256_setzero_si256())};
+    }
+    AVX2_LANES static V add(const V a, const V b) {
+        return V{_mm256_add_epi64(a.v, b.v)};
+    }
+    AVX2_LANES static V sub(const V a, const V b) {
+        return V{_mm256_sub_epi64(a.v, b.v)};
+    }
+    /* Multiply the low 32 bits of each lane, as signed numbers. */
+    AVX2_LANES static V mul(const V a, const int w) {
+        return V{_mm256_mul_epi32(a.v, _mm256_set1_epi64x(w))};
+    }
+    AVX2_LANES static void store(std::int64_t* p, const V a) {
+        _mm256_storeu_si256((__m256i*)p, a.v);
+    }
+};
+
+/* Eight positions at a time, with a popcount instruction for vectors */
+/* The masked forms of some operations are used to keep GCC 12 from */
+/* warning that their undefined pass-through lanes are uninitialized. */
+struct Avx512Lanes {
+    static constexpr int width = 8;
+    struct V {
+        __m512i v;
+    };
+
+    AVX512_LANES static V load(const std::uint64_t* p) {
+        return V{_mm512_loadu_si512(p)};
+    }
+    AVX512_LANES static V set(const std::uint64_t x) {
+        return V{_mm512_set1_epi64(x)};
+    }
+    template <int n>
+    AVX512_LANES static V shl(const V a) {
+        return V{_mm512_maskz_slli_epi64(0xFF, a.v, n)};
+    }
+    template <int n>
+    AVX512_LANES static V shr(const V a) {
+        return V{_mm512_maskz_srli_epi64(0xFF, a.v, n)};
+    }
+    AVX512_LANES static V and_(const V a, const V b) {
+        return V{_mm512_and_si512(a.v, b.v)};
+    }
+    AVX512_LANES static V or_(const V a, const V b) {
+        return V{_mm512_or_si512(a.v, b.v)};
+    }
+    AVX512_LANES static V andnot(const V a, const V b) {
+        return V{_mm512_maskz_andnot_epi64(0xFF, b.v, a.v)};
+    }
+    AVX512_LANES static V popcount(const V a) {
+        return V{_mm512_popcnt_epi64(a.v)};
+    }
+    AVX512_LANES static V add(const V a, const V b) {
+        return V{_mm512_add_epi64(a.v, b.v)};
+    }
+    AVX512_LANES static V sub(const V a, const V b) {
+        return V{_mm512_sub_epi64(a.v, b.v)};
+    }
+    /* Multiply the low 32 bits of each lane, as signed numbers. */
+    AVX512_LANES static V mul(const V a, const int w) {
+        return V{_mm512_maskz_mul_epi32(0xFF, a.v, _mm512_set1_epi64(w))};
+    }
+    AVX512_LANES static void store(std::int64_t* p, const V a) {
+        _mm512_storeu_si512(p, a.v);
+    }
+};
+#endif
+
+/* Get the files a step that changes file by df can't land on. */
+constexpr std::uint64_t wrapped_files(const int df) {
+    return df == 1    ? file_mask[FILE_A]
+           : df == 2  ? file_mask[FILE_A] | file_mask[FILE_B]
+           : df == -1 ? file_mask[FILE_H]
+           : df == -2 ? file_mask[FILE_G] | file_mask[FILE_H]
+                      : 0;
+}
+
+/* Shift sets of squares by a signed number of squares. */
+template <typename L, int d>
+LANES_INLINE typename L::V shift(const typename L::V& bb) {
+    return d > 0 ? L::template shl<(d > 0 ? d : 0)>(bb)
+                 : L::template shr<(d < 0 ? -d : 0)>(bb);
+}
+
+/* Move sets of squares by a step, dropping the ones that leave the board. */
+template <typename L, int d>
+LANES_INLINE typename L::V step(const typename L::V& bb) {
+    constexpr int df = ((d % 8) + 12) % 8 - 4;
+    return L::andnot(shift<L, d>(bb), L::set(wrapped_files(df)));
+}
+
+/* Get the squares sets of sliders attack in one direction, using a */
+/* Kogge-Stone fill. Each ray stops at the first piece, so the rays of */
+/* different sliders never overlap and counting the set counts them all. */
+template <typename L, int d>
+LANES_INLINE typename L::V slider_fill(const typename L::V& from,
+                                       const typename L::V& all_empty) {
+    constexpr int df = ((d % 8) + 12) % 8 - 4;
+    typename L::V sliders = from;
+    typename L::V empty = L::andnot(all_empty, L::set(wrapped_files(df)));
+    sliders = L::or_(sliders, L::and_(empty, shift<L, d>(sliders)));
+    empty = L::and_(empty, shift<L, d>(empty));
+    sliders = L::or_(sliders, L::and_(empty, shift<L, 2 * d>(sliders)));
+    empty = L::and_(empty, shift<L, 2 * d>(empty));
+    sliders = L::or_(sliders, L::and_(empty, shift<L, 4 * d>(sliders)));
+    return step<L, d>(sliders);
+}
+
+template <typename L>
+LANES_INLINE typename L::V diagonal_mobility(const typename L::V& sliders,
+                                             const typename L::V& empty) {
+    return L::add(L::add(L::popcount(slider_fill<L, 9>(sliders, empty)),
+                         L::popcount(slider_fill<L, 7>(sliders, empty))),
+                  L::add(L::popcount(slider_fill<L, -7>(sliders, empty)),
+                         L::popcount(slider_fill<L, -9>(sliders, empty))));
+}
+
+template <typename L>
+LANES_INLINE typename L::V straight_mobility(const typename L::V& sliders,
+                                             const typename L::V& empty) {
+    return L::add(L::add(L::popcount(slider_fill<L, 8>(sliders, empty)),
+                         L::popcount(slider_fill<L, 1>(sliders, empty))),
+                  L::add(L::popcount(slider_fill<L, -1>(sliders, empty)),
+                         L::popcount(slider_fill<L, -8>(sliders, empty))));
+}
+
+/* No two knights reach the same square with the same jump, so counting */
+/* each jump of the whole set counts every knight's attacks. */
+template <typename L>
+LANES_INLINE typename L::V knight_mobility(const typename L::V& knights) {
+    return L::add(L::add(L::add(L::popcount(step<L, 17>(knights)),
+                                L::popcount(step<L, 15>(knights))),
+                         L::add(L::popcount(step<L, 10>(knights)),
+                                L::popcount(step<L, 6>(knights)))),
+                  L::add(L::add(L::popcount(step<L, -6>(knights)),
+                                L::popcount(step<L, -10>(knights))),
+                         L::add(L::popcount(step<L, -15>(knights)),
+                                L::popcount(step<L, -17>(knights)))));
+}
+
+template <typename L>
+LANES_INLINE typename L::V king_area(const typename L::V& king) {
+    return L::or_(L::or_(L::or_(step<L, 8>(king), step<L, 9>(king)),
+                         L::or_(step<L, 1>(king), step<L, -7>(king))),
+                  L::or_(L::or_(step<L, -8>(king), step<L, -9>(king)),
+                         L::or_(step<L, -1>(king), step<L, 7>(king))));
+}
+
+/* Get the pawns of c that no enemy pawn can stop. */
+template <typename L, Colour c>
+LANES_INLINE typename L::V passers(const typename L::V& pawns,
+                                   const typename L::V& enemy_pawns) {
+    // The squares behind enemy pawns, from c's side, on their files
+    constexpr int down = c == WHITE ? -8 : 8;
+    typename L::V span = shift<L, down>(enemy_pawns);
+    span = L::or_(span, shift<L, down>(span));
+    span = L::or_(span, shift<L, 2 * down>(span));
+    span = L::or_(span, shift<L, 4 * down>(span));
+
+    return L::andnot(
+        pawns, L::or_(span, L::or_(step<L, 1>(span), step<L, -1>(span))));
+}
+
+/* Add up the king safety and the mobility and passer terms, which count */
+/* in both phases, of a side of the positions in some lanes. */
+template <typename L, Colour c>
+LANES_INLINE void side_terms(const typename L::V pieces[6],
+                             const typename L::V colours[2],
+                             typename L::V& opening, typename L::V& both) {
+    typedef typename L::V V;
+    const V us = colours[c];
+    const V empty =
+        L::andnot(L::set(~0ULL), L::or_(colours[WHITE], colours[BLACK]));
+
+    opening = L::mul(
+        L::popcount(L::and_(king_area<L>(L::and_(pieces[KING], us)), us)),
+        king_shelter);
+
+    both = L::mul(knight_mobility<L>(L::and_(pieces[KNIGHT], us)),
+                  mobility_weights[KNIGHT]);
+    both = L::add(both, L::mul(diagonal_mobility<L>(
+                                   L::and_(pieces[BISHOP], us), empty),
+                               mobility_weights[BISHOP]));
+    both = L::add(both, L::mul(straight_mobility<L>(
+                                   L::and_(pieces[ROOK], us), empty),
+                               mobility_weights[ROOK]));
+    const V queens = L::and_(pieces[QUEEN], us);
+    both = L::add(both, L::mul(L::add(diagonal_mobility<L>(queens, empty),
+                                      straight_mobility<L>(queens, empty)),
+                               mobility_weights[QUEEN]));
+
+    const V passed = passers<L, c>(L::and_(pieces[PAWN], us),
+                                   L::andnot(pieces[PAWN], us));
+    for (int r = RANK_2; r <= RANK_7; ++r) {
+        both = L::add(
+            both,
+            L::mul(L::popcount(L::and_(passed, L::set(rank_mask[r]))),
+                   passed_pawn_bonus[relative_rank(c, Rank(r))]));
+    }
+}
+
+/* Add material and PST to the other terms of a batch position, which are */
+/* from white's side, and taper the sum for the side to move. */
+inline int finish_lane(const EvalBatch& batch, const std::size_t i,
+                       const int opening_terms, const int both_terms) {
+    const Score white = batch.psq[WHITE][i], black = batch.psq[BLACK][i];
+    const int sign = batch.side[i] == WHITE ? 1 : -1;
+    const int opening = sign * (opening_terms + both_terms +
+                                opening_score(white) - opening_score(black));
+    const int endgame = sign * (both_terms + endgame_score(white) -
+                                endgame_score(black));
+    const int phase = batch.phase[i];
+
+    return ((phase * opening) + ((24 - phase) * endgame)) / 24;
+}
+
+/* Evaluate the positions of a batch from first on, a group of lanes at a */
+/* time, and return where the positions left over for narrower lanes start. */
+template <typename L>
+LANES_INLINE std::size_t evaluate_lanes(const EvalBatch& batch,
+                                        std::size_t first, int* scores) {
+    typedef typename L::V V;
+
+    for (; first + L::width <= batch.side.size(); first += L::width) {
+        V pieces[6];
+        for (int i = 0; i < 6; ++i) {
+            pieces[i] = L::load(batch.pieces[i].data() + first);
+        }
+        const V colours[2] = {L::load(batch.colours[WHITE].data() + first),
+                              L::load(batch.colours[BLACK].data() + first)};
+
+        V white_opening, white_both, black_opening, black_both;
+        side_terms<L, WHITE>(pieces, colours, white_opening, white_both);
+        side_terms<L, BLACK>(pieces, colours, black_opening, black_both);
+
+        std::int64_t opening[L::width], both[L::width];
+        L::store(opening, L::sub(white_opening, black_opening));
+        L::store(both, L::sub(white_both, black_both));
+
+        for (int i = 0; i < L::width; ++i) {
+            scores[first + i] =
+                finish_lane(batch, first + i, opening[i], both[i]);
+        }
+    }
+
+    return first;
+}
+
+static void evaluate_batch_generic(const EvalBatch& batch, int* scores) {
+    evaluate_lanes<ScalarLanes>(batch, 0, scores);
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("avx2")))
+static void evaluate_batch_avx2(const EvalBatch& batch, int* scores) {
+    const std::size_t rest = evaluate_lanes<Avx2Lanes>(batch, 0, scores);
+    evaluate_lanes<ScalarLanes>(batch, rest, scores);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void evaluate_batch_avx512(const EvalBatch& batch, int* scores) {
+    const std::size_t rest = evaluate_lanes<Avx512Lanes>(batch, 0, scores);
+    evaluate_lanes<ScalarLanes>(batch, rest, scores);
+}
+#endif
+
+typedef void (*EvaluateBatch)(const EvalBatch&, int*);
+
+/* Use the widest lanes the CPU can count bits in. */
+static EvaluateBatch pick_evaluate_batch() {
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512vpopcntdq")) {
+        return evaluate_batch_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return evaluate_batch_avx2;
+    }
+#endif
+    return evaluate_batch_generic;
+}
+
+static const EvaluateBatch evaluate_batch_best = pick_evaluate_batch();
+
+/* Evaluate every position of a batch for its side to move, exactly as */
+/* evaluate() would. */
+void evaluate_batch(const EvalBatch& batch, int* scores) {
+    evaluate_batch_best(batch, scores);
+
+#ifndef NDEBUG
+    for (std::size_t i = 0; i < batch.side.size(); ++i) {
+        assert(scores[i] == batch.expected[i]);
+    }
+#endif
+}
+
+/* Evaluate a batch with lanes of one position and with each kind of */
+/* vector lanes the CPU has, and count the scores that differ from */
+/* evaluate()'s. */
+std::size_t eval_batch_check(const EvalBatch& batch,
+                             const std::vector<int>& expected) {
+    std::vector<EvaluateBatch> kernels = {evaluate_batch_generic};
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(evaluate_batch_avx2);
+    }
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512vpopcntdq")) {
+        kernels.push_back(evaluate_batch_avx512);
+    }
+#endif
+
+    std::size_t mismatches = 0;
+    std::vector<int> scores(batch.side.size());
+    for (EvaluateBatch kernel : kernels) {
+        kernel(batch, scores.data());
+        for (std::size_t i = 0; i < scores.size(); ++i) {
+            mismatches += scores[i] != expected[i];
+        }
+    }
+    return mismatches;
 }
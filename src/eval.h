@@ -27,10 +27,107 @@ SOFTWARE.
 #ifndef EVAL_H
 #define EVAL_H
 
+#include <vector>
+
 #include "position.h"
 
+/* The tunable evaluation parameters, see psqt.h */
 extern const int piecevals[2][7];
+extern const int mobility_weights[7];
+extern const int passed_pawn_bonus[8];
+extern const int pst[6][2][64];
+
+/* Number of tunable parameters: material and PST for each phase, */
+/* mobility of knights to queens, and passed pawns on ranks 2 to 7 */
+#define EVAL_PARAMS (2 * 5 + 2 * 6 * 64 + 4 + 6)
+
+/* The phases a tunable parameter is scored in */
+enum ParamPhase : std::uint8_t { PARAM_OPENING, PARAM_ENDGAME, PARAM_BOTH };
+
+/* A tunable parameter of the evaluation */
+struct EvalParam {
+    const int* value;
+    ParamPhase phase;
+};
+
+/* The evaluation of a position from white's side, as how often each */
+/* tunable parameter counts in it plus the terms that aren't tuned */
+struct EvalTrace {
+    std::int16_t coefficients[EVAL_PARAMS];
+    int opening;
+    int endgame;
+    int phase;  // Phase of the side to move.
+};
+
+/* Entries in each thread's pawn table, a power of two */
+#define PAWN_TABLE_SIZE (1 << 14)
+
+/* The evaluation of a pawn structure */
+struct PawnEntry {
+    std::uint64_t key;        // Pawn key of the structure.
+    std::uint64_t passed[2];  // Passed pawns of each colour.
+    std::int16_t opening;     // Scores from white's side.
+    std::int16_t endgame;
+};
+
+/* A cache of pawn structure evaluations, one per search thread */
+struct PawnTable {
+    std::vector<PawnEntry> entries = std::vector<PawnEntry>(PAWN_TABLE_SIZE);
+};
+
+/* Positions stored term by term rather than position by position, so that */
+/* evaluate_batch() can work on several positions at once. */
+struct EvalBatch {
+    std::vector<std::uint64_t> pieces[6];
+    std::vector<std::uint64_t> colours[2];
+    std::vector<Score> psq[2];
+    std::vector<std::uint8_t> phase;  // Phase of the side to move.
+    std::vector<Colour> side;
+#ifndef NDEBUG
+    std::vector<int> expected;  // evaluate() of each position.
+#endif
+};
+
+/* Entries in each thread's eval table, a power of two */
+#define EVAL_TABLE_SIZE (1 << 16)
+
+/* A cache of static evals, one per search thread. Each entry keeps the */
+/* high 48 bits of the hash key and the eval in the low 16 bits. */
+struct EvalTable {
+    std::vector<std::uint64_t> entries =
+        std::vector<std::uint64_t>(EVAL_TABLE_SIZE);
+};
+
+extern void init_psq_scores();
+extern void eval_params(EvalParam* params);
+extern void evaluate_trace(const Position& pos, EvalTrace& trace);
+extern int evaluate(const Position& pos);
+extern int evaluate(const Position& pos, PawnTable& table);
+extern int evaluate(const Position& pos, PawnTable& table, const int alpha,
+                    const int beta, bool& exact);
+
+/* Look the static eval of a position up in an eval table. */
+inline bool eval_table_probe(const EvalTable& table, const Position& pos,
+                             int& eval) {
+    const std::uint64_t entry =
+        table.entries[pos.hash_key & (EVAL_TABLE_SIZE - 1)];
+    if ((entry ^ pos.hash_key) >> 16) {
+        return false;
+    }
+    eval = (std::int16_t)(entry & 0xFFFF);
+    return true;
+}
 
-extern int evaluate(Position& pos);
+/* Store the static eval of a position in an eval table. */
+inline void eval_table_store(EvalTable& table, const Position& pos,
+                             const int eval) {
+    table.entries[pos.hash_key & (EVAL_TABLE_SIZE - 1)] =
+        (pos.hash_key & ~0xFFFFULL) | (std::uint16_t)eval;
+}
+extern void eval_batch_clear(EvalBatch& batch);
+extern void eval_batch_add(EvalBatch& batch, const Position& pos);
+extern void evaluate_batch(const EvalBatch& batch, int* scores);
+extern std::size_t eval_batch_check(const EvalBatch& batch,
+                                    const std::vector<int>& expected);
 
 #endif
@@ -5,6 +5,8 @@
  *
  *See header file for instructions on usage.
  *
+ *Altered to build the databases with constexpr functions at compile time.
+ *
  *The magic keys are not optimal for all squares but they are very close
  *to optimal.
  *
@@ -50,7 +52,7 @@
 //C64(0x007FFCDDFCED714A) - B8 10 bit
 //C64(0x003FFFCDFFD88096) - C8 10 bit
 
-const unsigned int magicmoves_r_shift[64]=
+constexpr unsigned int magicmoves_r_shift[64]=
 {
     52, 53, 53, 53, 53, 53, 53, 52,
     53, 54, 54, 54, 54, 54, 54, 53,
@@ -62,7 +64,7 @@ const unsigned int magicmoves_r_shift[64]=
     53, 54, 54, 53, 53, 53, 53, 53
 };
 
-const U64 magicmoves_r_magics[64]=
+constexpr U64 magicmoves_r_magics[64]=
 {
     C64(0x0080001020400080), C64(0x0040001000200040), C64(0x0080081000200080), C64(0x0080040800100080),
     C64(0x0080020400080080), C64(0x0080010200040080), C64(0x0080008001000200), C64(0x0080002040800100),
@@ -81,7 +83,7 @@ const U64 magicmoves_r_magics[64]=
     C64(0x00FFFCDDFCED714A), C64(0x007FFCDDFCED714A), C64(0x003FFFCDFFD88096), C64(0x0000040810002101),
     C64(0x0001000204080011), C64(0x0001000204000801), C64(0x0001000082000401), C64(0x0001FFFAABFAD1A2)
 };
-const U64 magicmoves_r_mask[64]=
+constexpr U64 magicmoves_r_mask[64]=
 {
     C64(0x000101010101017E), C64(0x000202020202027C), C64(0x000404040404047A), C64(0x0008080808080876),
     C64(0x001010101010106E), C64(0x002020202020205E), C64(0x004040404040403E), C64(0x008080808080807E),
@@ -102,7 +104,7 @@ const U64 magicmoves_r_mask[64]=
 };
 
 //my original tables for bishops
-const unsigned int magicmoves_b_shift[64]=
+constexpr unsigned int magicmoves_b_shift[64]=
 {
     58, 59, 59, 59, 59, 59, 59, 58,
     59, 59, 59, 59, 59, 59, 59, 59,
@@ -114,7 +116,7 @@ const unsigned int magicmoves_b_shift[64]=
     58, 59, 59, 59, 59, 59, 59, 58
 };
 
-const U64 magicmoves_b_magics[64]=
+constexpr U64 magicmoves_b_magics[64]=
 {
     C64(0x0002020202020200), C64(0x0002020202020000), C64(0x0004010202000000), C64(0x0004040080000000),
     C64(0x0001104000000000), C64(0x0000821040000000), C64(0x0000410410400000), C64(0x0000104104104000),
@@ -135,7 +137,7 @@ const U64 magicmoves_b_magics[64]=
 };
 
 
-const U64 magicmoves_b_mask[64]=
+constexpr U64 magicmoves_b_mask[64]=
 {
     C64(0x0040201008040200), C64(0x0000402010080400), C64(0x0000004020100A00), C64(0x0000000040221400),
     C64(0x0000000002442800), C64(0x0000000204085000), C64(0x0000020408102000), C64(0x0002040810204000),
@@ -155,79 +157,10 @@ const U64 magicmoves_b_mask[64]=
     C64(0x0028440200000000), C64(0x0050080402000000), C64(0x0020100804020000), C64(0x0040201008040200)
 };
 
-#ifdef MINIMIZE_MAGIC
-U64 magicmovesbdb[5248];
-const U64* magicmoves_b_indices[64]=
-{
-    magicmovesbdb+4992, magicmovesbdb+2624,  magicmovesbdb+256,  magicmovesbdb+896,
-    magicmovesbdb+1280, magicmovesbdb+1664, magicmovesbdb+4800, magicmovesbdb+5120,
-    magicmovesbdb+2560, magicmovesbdb+2656,  magicmovesbdb+288,  magicmovesbdb+928,
-    magicmovesbdb+1312, magicmovesbdb+1696, magicmovesbdb+4832, magicmovesbdb+4928,
-    magicmovesbdb+0,     magicmovesbdb+128,  magicmovesbdb+320,  magicmovesbdb+960,
-    magicmovesbdb+1344, magicmovesbdb+1728, magicmovesbdb+2304, magicmovesbdb+2432,
-    magicmovesbdb+32,    magicmovesbdb+160,  magicmovesbdb+448, magicmovesbdb+2752,
-    magicmovesbdb+3776, magicmovesbdb+1856, magicmovesbdb+2336, magicmovesbdb+2464,
-    magicmovesbdb+64,    magicmovesbdb+192,  magicmovesbdb+576, magicmovesbdb+3264,
-    magicmovesbdb+4288, magicmovesbdb+1984, magicmovesbdb+2368, magicmovesbdb+2496,
-    magicmovesbdb+96,    magicmovesbdb+224,  magicmovesbdb+704, magicmovesbdb+1088,
-    magicmovesbdb+1472, magicmovesbdb+2112, magicmovesbdb+2400, magicmovesbdb+2528,
-    magicmovesbdb+2592, magicmovesbdb+2688,  magicmovesbdb+832, magicmovesbdb+1216,
-    magicmovesbdb+1600, magicmovesbdb+2240, magicmovesbdb+4864, magicmovesbdb+4960,
-    magicmovesbdb+5056, magicmovesbdb+2720,  magicmovesbdb+864, magicmovesbdb+1248,
-    magicmovesbdb+1632, magicmovesbdb+2272, magicmovesbdb+4896, magicmovesbdb+5184
-};
-#else
-    #ifndef PERFECT_MAGIC_HASH
-        U64 magicmovesbdb[64][1<<9];
-    #else
-        U64 magicmovesbdb[1428];
-        PERFECT_MAGIC_HASH magicmoves_b_indices[64][1<<9];
-    #endif
-#endif
-
-#ifdef MINIMIZE_MAGIC
-U64 magicmovesrdb[102400];
-const U64* magicmoves_r_indices[64]=
-{
-    magicmovesrdb+86016, magicmovesrdb+73728, magicmovesrdb+36864, magicmovesrdb+43008,
-    magicmovesrdb+47104, magicmovesrdb+51200, magicmovesrdb+77824, magicmovesrdb+94208,
-    magicmovesrdb+69632, magicmovesrdb+32768, magicmovesrdb+38912, magicmovesrdb+10240,
-    magicmovesrdb+14336, magicmovesrdb+53248, magicmovesrdb+57344, magicmovesrdb+81920,
-    magicmovesrdb+24576, magicmovesrdb+33792,  magicmovesrdb+6144, magicmovesrdb+11264,
-    magicmovesrdb+15360, magicmovesrdb+18432, magicmovesrdb+58368, magicmovesrdb+61440,
-    magicmovesrdb+26624,  magicmovesrdb+4096,  magicmovesrdb+7168,     magicmovesrdb+0,
-     magicmovesrdb+2048, magicmovesrdb+19456, magicmovesrdb+22528, magicmovesrdb+63488,
-    magicmovesrdb+28672,  magicmovesrdb+5120,  magicmovesrdb+8192,  magicmovesrdb+1024,
-     magicmovesrdb+3072, magicmovesrdb+20480, magicmovesrdb+23552, magicmovesrdb+65536,
-    magicmovesrdb+30720, magicmovesrdb+34816,  magicmovesrdb+9216, magicmovesrdb+12288,
-    magicmovesrdb+16384, magicmovesrdb+21504, magicmovesrdb+59392, magicmovesrdb+67584,
-    magicmovesrdb+71680, magicmovesrdb+35840, magicmovesrdb+39936, magicmovesrdb+13312,
-    magicmovesrdb+17408, magicmovesrdb+54272, magicmovesrdb+60416, magicmovesrdb+83968,
-    magicmovesrdb+90112, magicmovesrdb+75776, magicmovesrdb+40960, magicmovesrdb+45056,
-    magicmovesrdb+49152, magicmovesrdb+55296, magicmovesrdb+79872, magicmovesrdb+98304
-};
-#else
-    #ifndef PERFECT_MAGIC_HASH
-        U64 magicmovesrdb[64][1<<12];
-    #else
-        U64 magicmovesrdb[4900];
-        PERFECT_MAGIC_HASH magicmoves_r_indices[64][1<<12];
-    #endif
-#endif
-
-U64 initmagicmoves_occ(const int* squares, const int numSquares, const U64 linocc)
+constexpr U64 initmagicmoves_Rmoves(const int square, const U64 occ)
 {
-    int i;
     U64 ret=0;
-    for(i=0;i<numSquares;i++)
-        if(linocc&(((U64)(1))<<i)) ret|=(((U64)(1))<<squares[i]);
-    return ret;
-}
-
-U64 initmagicmoves_Rmoves(const int square, const U64 occ)
-{
-    U64 ret=0;
-    U64 bit;
+    U64 bit=0;
     U64 rowbits=(((U64)0xFF)<<(8*(square/8)));
 
     bit=(((U64)(1))<<square);
@@ -259,11 +192,11 @@ U64 initmagicmoves_Rmoves(const int square, const U64 occ)
     return ret;
 }
 
-U64 initmagicmoves_Bmoves(const int square, const U64 occ)
+constexpr U64 initmagicmoves_Bmoves(const int square, const U64 occ)
 {
     U64 ret=0;
-    U64 bit;
-    U64 bit2;
+    U64 bit=0;
+    U64 bit2=0;
     U64 rowbits=(((U64)0xFF)<<(8*(square/8)));
 
     bit=(((U64)(1))<<square);
@@ -305,165 +238,66 @@ U64 initmagicmoves_Bmoves(const int square, const U64 occ)
     return ret;
 }
 
-//used so that the original indices can be left as const so that the compiler can optimize better
+//the squares of a rank share a chunk of the database, so that each chunk is a
+//separate constant expression and stays within the compiler's evaluation limits
 
-#ifndef PERFECT_MAGIC_HASH
-    #ifdef MINIMIZE_MAGIC
-        #define BmagicNOMASK2(square, occupancy) *(magicmoves_b_indices2[square]+(((occupancy)*magicmoves_b_magics[square])>>magicmoves_b_shift[square]))
-        #define RmagicNOMASK2(square, occupancy) *(magicmoves_r_indices2[square]+(((occupancy)*magicmoves_r_magics[square])>>magicmoves_r_shift[square]))
-    #else
-        #define BmagicNOMASK2(square, occupancy) magicmovesbdb[square][((occupancy)*magicmoves_b_magics[square])>>MINIMAL_B_BITS_SHIFT(square)]
-        #define RmagicNOMASK2(square, occupancy) magicmovesrdb[square][((occupancy)*magicmoves_r_magics[square])>>MINIMAL_R_BITS_SHIFT(square)]
-    #endif
-/*#else
-    #define BmagicNOMASK2(square, occupancy) magicmovesbdb[magicmoves_b_indices[square][((occupancy)*magicmoves_b_magics[square])>>MINIMAL_B_BITS_SHIFT]]
-    #define RmagicNOMASK2(square, occupancy) magicmovesrdb[magicmoves_r_indices[square][((occupancy)*magicmoves_r_magics[square])>>MINIMAL_R_BITS_SHIFT]]
-*/
-#endif
-
-void initmagicmoves(void)
+constexpr unsigned int initmagicmoves_size(const bool rook, const int rank)
 {
-    int i;
-
-    //for bitscans :
-    //initmagicmoves_bitpos64_database[(x*C64(0x07EDD5E59A4E28C2))>>58]
-    int initmagicmoves_bitpos64_database[64]={
-    63,  0, 58,  1, 59, 47, 53,  2,
-    60, 39, 48, 27, 54, 33, 42,  3,
-    61, 51, 37, 40, 49, 18, 28, 20,
-    55, 30, 34, 11, 43, 14, 22,  4,
-    62, 57, 46, 52, 38, 26, 32, 41,
-    50, 36, 17, 19, 29, 10, 13, 21,
-    56, 45, 25, 31, 35, 16,  9, 12,
-    44, 24, 15,  8, 23,  7,  6,  5};
+    unsigned int size=0;
+    for(int i=8*rank;i<8*rank+8;i++)
+        size+=1u<<(64-(rook?magicmoves_r_shift[i]:magicmoves_b_shift[i]));
+    return size;
+}
 
-#ifdef MINIMIZE_MAGIC
-    //identical to magicmove_x_indices except without the const modifer
-    U64* magicmoves_b_indices2[64]=
-    {
-        magicmovesbdb+4992, magicmovesbdb+2624,  magicmovesbdb+256,  magicmovesbdb+896,
-        magicmovesbdb+1280, magicmovesbdb+1664, magicmovesbdb+4800, magicmovesbdb+5120,
-        magicmovesbdb+2560, magicmovesbdb+2656,  magicmovesbdb+288,  magicmovesbdb+928,
-        magicmovesbdb+1312, magicmovesbdb+1696, magicmovesbdb+4832, magicmovesbdb+4928,
-        magicmovesbdb+0,     magicmovesbdb+128,  magicmovesbdb+320,  magicmovesbdb+960,
-        magicmovesbdb+1344, magicmovesbdb+1728, magicmovesbdb+2304, magicmovesbdb+2432,
-        magicmovesbdb+32,    magicmovesbdb+160,  magicmovesbdb+448, magicmovesbdb+2752,
-        magicmovesbdb+3776, magicmovesbdb+1856, magicmovesbdb+2336, magicmovesbdb+2464,
-        magicmovesbdb+64,    magicmovesbdb+192,  magicmovesbdb+576, magicmovesbdb+3264,
-        magicmovesbdb+4288, magicmovesbdb+1984, magicmovesbdb+2368, magicmovesbdb+2496,
-        magicmovesbdb+96,    magicmovesbdb+224,  magicmovesbdb+704, magicmovesbdb+1088,
-        magicmovesbdb+1472, magicmovesbdb+2112, magicmovesbdb+2400, magicmovesbdb+2528,
-        magicmovesbdb+2592, magicmovesbdb+2688,  magicmovesbdb+832, magicmovesbdb+1216,
-        magicmovesbdb+1600, magicmovesbdb+2240, magicmovesbdb+4864, magicmovesbdb+4960,
-        magicmovesbdb+5056, magicmovesbdb+2720,  magicmovesbdb+864, magicmovesbdb+1248,
-        magicmovesbdb+1632, magicmovesbdb+2272, magicmovesbdb+4896, magicmovesbdb+5184
-    };
-    U64* magicmoves_r_indices2[64]=
+//fills a chunk by walking the subsets of each square's mask with the carry-rippler
+template <unsigned int size>
+constexpr magicmoves_db<size> initmagicmoves_db(const bool rook, const int rank)
+{
+    magicmoves_db<size> db{};
+    unsigned int index=0;
+    for(int i=8*rank;i<8*rank+8;i++)
     {
-        magicmovesrdb+86016, magicmovesrdb+73728, magicmovesrdb+36864, magicmovesrdb+43008,
-        magicmovesrdb+47104, magicmovesrdb+51200, magicmovesrdb+77824, magicmovesrdb+94208,
-        magicmovesrdb+69632, magicmovesrdb+32768, magicmovesrdb+38912, magicmovesrdb+10240,
-        magicmovesrdb+14336, magicmovesrdb+53248, magicmovesrdb+57344, magicmovesrdb+81920,
-        magicmovesrdb+24576, magicmovesrdb+33792,  magicmovesrdb+6144, magicmovesrdb+11264,
-        magicmovesrdb+15360, magicmovesrdb+18432, magicmovesrdb+58368, magicmovesrdb+61440,
-        magicmovesrdb+26624,  magicmovesrdb+4096,  magicmovesrdb+7168,     magicmovesrdb+0,
-        magicmovesrdb+2048,  magicmovesrdb+19456, magicmovesrdb+22528, magicmovesrdb+63488,
-        magicmovesrdb+28672,  magicmovesrdb+5120,  magicmovesrdb+8192,  magicmovesrdb+1024,
-        magicmovesrdb+3072,  magicmovesrdb+20480, magicmovesrdb+23552, magicmovesrdb+65536,
-        magicmovesrdb+30720, magicmovesrdb+34816,  magicmovesrdb+9216, magicmovesrdb+12288,
-        magicmovesrdb+16384, magicmovesrdb+21504, magicmovesrdb+59392, magicmovesrdb+67584,
-        magicmovesrdb+71680, magicmovesrdb+35840, magicmovesrdb+39936, magicmovesrdb+13312,
-        magicmovesrdb+17408, magicmovesrdb+54272, magicmovesrdb+60416, magicmovesrdb+83968,
-        magicmovesrdb+90112, magicmovesrdb+75776, magicmovesrdb+40960, magicmovesrdb+45056,
-        magicmovesrdb+49152, magicmovesrdb+55296, magicmovesrdb+79872, magicmovesrdb+98304
-    };
-#endif // MINIMIZE_MAGIC
-
+        const U64 mask=rook?magicmoves_r_mask[i]:magicmoves_b_mask[i];
+        const U64 magic=rook?magicmoves_r_magics[i]:magicmoves_b_magics[i];
+        const unsigned int shift=rook?magicmoves_r_shift[i]:magicmoves_b_shift[i];
+        U64 occ=0;
+        do
+        {
+            db.moves[index+((occ*magic)>>shift)]=rook?initmagicmoves_Rmoves(i,occ):initmagicmoves_Bmoves(i,occ);
+            occ=(occ-mask)&mask;
+        }while(occ);
+        index+=1u<<(64-shift);
+    }
+    return db;
+}
 
-#ifdef PERFECT_MAGIC_HASH
-    for(i=0;i<1428;i++)
-        magicmovesbdb[i]=0;
-    for(i=0;i<4900;i++)
-        magicmovesrdb[i]=0;
-#endif
+template <int rank>
+constexpr magicmoves_db<initmagicmoves_size(false,rank)> magicmovesbdb=initmagicmoves_db<initmagicmoves_size(false,rank)>(false,rank);
+template <int rank>
+constexpr magicmoves_db<initmagicmoves_size(true,rank)> magicmovesrdb=initmagicmoves_db<initmagicmoves_size(true,rank)>(true,rank);
 
-    for(i=0;i<64;i++)
+constexpr magicmoves_squares initmagicmoves_squares(const bool rook)
+{
+    const U64* const ranks[8]=
     {
-        int squares[64];
-        int numsquares=0;
-        U64 temp=magicmoves_b_mask[i];
-        while(temp)
-        {
-            U64 bit=temp&-temp;
-            squares[numsquares++]=initmagicmoves_bitpos64_database[(bit*C64(0x07EDD5E59A4E28C2))>>58];
-            temp^=bit;
-        }
-        for(temp=0;temp<(((U64)(1))<<numsquares);temp++)
-        {
-            U64 tempocc=initmagicmoves_occ(squares,numsquares,temp);
-            #ifndef PERFECT_MAGIC_HASH
-                BmagicNOMASK2(i,tempocc)=initmagicmoves_Bmoves(i,tempocc);
-            #else
-                U64 moves=initmagicmoves_Bmoves(i,tempocc);
-                U64 index=(((tempocc)*magicmoves_b_magics[i])>>MINIMAL_B_BITS_SHIFT);
-                int j;
-                for(j=0;j<1428;j++)
-                {
-                    if(!magicmovesbdb[j])
-                    {
-                        magicmovesbdb[j]=moves;
-                        magicmoves_b_indices[i][index]=j;
-                        break;
-                    }
-                    else if(magicmovesbdb[j]==moves)
-                    {
-                        magicmoves_b_indices[i][index]=j;
-                        break;
-                    }
-                }
-            #endif
-        }
-    }
-    for(i=0;i<64;i++)
+        rook?magicmovesrdb<0>.moves:magicmovesbdb<0>.moves, rook?magicmovesrdb<1>.moves:magicmovesbdb<1>.moves,
+        rook?magicmovesrdb<2>.moves:magicmovesbdb<2>.moves, rook?magicmovesrdb<3>.moves:magicmovesbdb<3>.moves,
+        rook?magicmovesrdb<4>.moves:magicmovesbdb<4>.moves, rook?magicmovesrdb<5>.moves:magicmovesbdb<5>.moves,
+        rook?magicmovesrdb<6>.moves:magicmovesbdb<6>.moves, rook?magicmovesrdb<7>.moves:magicmovesbdb<7>.moves
+    };
+    magicmoves_squares table{};
+    const U64* next=ranks[0];
+    for(int i=0;i<64;i++)
     {
-        int squares[64];
-        int numsquares=0;
-        U64 temp=magicmoves_r_mask[i];
-        while(temp)
-        {
-            U64 bit=temp&-temp;
-            squares[numsquares++]=initmagicmoves_bitpos64_database[(bit*C64(0x07EDD5E59A4E28C2))>>58];
-            temp^=bit;
-        }
-        for(temp=0;temp<(((U64)(1))<<numsquares);temp++)
-        {
-            U64 tempocc=initmagicmoves_occ(squares,numsquares,temp);
-            #ifndef PERFECT_MAGIC_HASH
-                RmagicNOMASK2(i,tempocc)=initmagicmoves_Rmoves(i,tempocc);
-            #else
-                U64 moves=initmagicmoves_Rmoves(i,tempocc);
-                U64 index=(((tempocc)*magicmoves_r_magics[i])>>MINIMAL_R_BITS_SHIFT);
-                int j;
-                for(j=0;j<4900;j++)
-                {
-                    if(!magicmovesrdb[j])
-                    {
-                        magicmovesrdb[j]=moves;
-                        magicmoves_r_indices[i][index]=j;
-                        break;
-                    }
-                    else if(magicmovesrdb[j]==moves)
-                    {
-                        magicmoves_r_indices[i][index]=j;
-                        break;
-                    }
-                }
-            #endif
-        }
+        if(i%8==0) next=ranks[i/8];
+        table.squares[i].moves=next;
+        table.squares[i].mask=rook?magicmoves_r_mask[i]:magicmoves_b_mask[i];
+        table.squares[i].magic=rook?magicmoves_r_magics[i]:magicmoves_b_magics[i];
+        table.squares[i].shift=rook?magicmoves_r_shift[i]:magicmoves_b_shift[i];
+        next+=1u<<(64-table.squares[i].shift);
     }
+    return table;
 }
 
-void initMagics()
-{
-    initmagicmoves();
-}
+constexpr magicmoves_squares magicmoves_b_squares=initmagicmoves_squares(false);
+constexpr magicmoves_squares magicmoves_r_squares=initmagicmoves_squares(true);
@@ -28,13 +28,26 @@ SOFTWARE.
 #include <string>
 
 #include "bitboard.h"
+#include "eval.h"
 #include "position.h"
 #include "uci.h"
 
 int main() {
-    seed_rng(17594872);
-    init_keys();
-    init_bitboards();
+#if defined(USE_PEXT)
+    // The build is the dispatch, so a CPU it doesn't suit is only told so.
+    if (!bmi2_supported()) {
+        std::cout << "This build needs BMI2, use the default build"
+                  << std::endl;
+        return 1;
+    }
+    if (!pext_is_fast()) {
+        std::cout << "PEXT is slow on this CPU, the default build is faster"
+                  << std::endl;
+    }
+#endif
+
+    init_psq_scores();
+    init_cuckoo();
 
     std::setbuf(stdout, NULL);
     std::setbuf(stdin, NULL);
@@ -27,27 +27,18 @@ SOFTWARE.
 #ifndef MISC_H
 #define MISC_H
 
-#include <random>
+#include <chrono>
 
 #include "types.h"
 
 #define MAX_PLY (64)
 #define INF (30000)
 
-/* The Mersenne twister random number generator */
-static std::mt19937 rng;
-
-/* Seed the random number generator with the specified seed */
-inline void seed_rng(std::uint32_t seed) { rng.seed(seed); }
-
-/* Get a random 64 bit number */
-inline std::uint64_t get_rand64() {
-    static std::uniform_int_distribution<std::uint64_t> dist;
-    std::uint64_t r;
-    do {
-        r = dist(rng);
-    } while (!r);
-    return r;
+/* Get a monotonic time in milliseconds. */
+inline std::int64_t now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
 }
 
 #endif
@@ -25,6 +25,8 @@ SOFTWARE.
 */
 
 #include <cassert>
+#include <cstdio>
+#include <string>
 
 #include "types.h"
 #include "move.h"
@@ -55,50 +57,112 @@ static const char *square_str[] = {
 };
 
 void make_move(Position& pos, const Move move) {
-    pos.epsq = INVALID_SQUARE;
+    Undo undo;
+    make_move(pos, move, undo);
+}
 
+/* Make a move for the side to move, US. */
+template <Colour US>
+void make_move(Position& pos, const Move move, Undo& undo) {
+    constexpr Colour THEM = ~US;
     const Square from = from_square(move), to = to_square(move);
     const MoveType mt = move_type(move);
+    const Piece piece = get_piece_on_square(pos, from);
+    const std::uint8_t castle =
+        pos.castle & castling_lookup[from] & castling_lookup[to];
+
+    undo.hash_key = pos.hash_key;
+    undo.pawn_key = pos.pawn_key;
+    undo.piece = piece;
+    undo.captured = NO_PIECE;
+    undo.castle = pos.castle;
+    undo.epsq = pos.epsq;
+    undo.halfmoves = pos.halfmoves;
+
+    std::uint64_t key = pos.hash_key ^ side_key;
+    std::uint64_t pawn_key = pos.pawn_key;
+
+    key ^= castle_key(pos.castle) ^ castle_key(castle);
+    pos.castle = castle;
+
+    if (pos.epsq != INVALID_SQUARE) {
+        key ^= ep_keys[pos.epsq & 7];
+        pos.epsq = INVALID_SQUARE;
+    }
 
-    pos.castle &= castling_lookup[from] & castling_lookup[to];
-
+    Piece captured;
     switch (mt) {
         case NORMAL:
-            move_piece(pos, from, to, get_piece_on_square(pos, from), US);
+            move_piece(pos, from, to, piece, US);
+            key ^= piece_key(piece, from, US) ^ piece_key(piece, to, US);
+            if (piece == PAWN) {
+                pawn_key ^= piece_key(PAWN, from, US) ^ piece_key(PAWN, to, US);
+            }
             break;
         case CAPTURE:
-            remove_piece(pos, to, get_piece_on_square(pos, to), THEM);
-            move_piece(pos, from, to, get_piece_on_square(pos, from), US);
+            captured = undo.captured = get_piece_on_square(pos, to);
+            remove_piece(pos, to, captured, THEM);
+            move_piece(pos, from, to, piece, US);
+            key ^= piece_key(captured, to, THEM);
+            key ^= piece_key(piece, from, US) ^ piece_key(piece, to, US);
+            if (captured == PAWN) {
+                pawn_key ^= piece_key(PAWN, to, THEM);
+            }
+            if (piece == PAWN) {
+                pawn_key ^= piece_key(PAWN, from, US) ^ piece_key(PAWN, to, US);
+            }
             break;
         case DOUBLE_PUSH:
             move_piece(pos, from, to, PAWN, US);
-            pos.epsq = from + 8;
+            pos.epsq = Square((from + to) / 2);
+            key ^= piece_key(PAWN, from, US) ^ piece_key(PAWN, to, US);
+            key ^= ep_keys[from & 7];
+            pawn_key ^= piece_key(PAWN, from, US) ^ piece_key(PAWN, to, US);
             break;
         case ENPASSANT:
             move_piece(pos, from, to, PAWN, US);
-            remove_piece(pos, to - 8, PAWN, THEM);
+            remove_piece(pos, Square(to ^ 8), PAWN, THEM);
+            key ^= piece_key(PAWN, from, US) ^ piece_key(PAWN, to, US);
+            key ^= piece_key(PAWN, Square(to ^ 8), THEM);
+            pawn_key ^= piece_key(PAWN, from, US) ^ piece_key(PAWN, to, US);
+            pawn_key ^= piece_key(PAWN, Square(to ^ 8), THEM);
             break;
         case CASTLE:
             move_piece(pos, from, to, KING, US);
-            switch (to) {
+            key ^= piece_key(KING, from, US) ^ piece_key(KING, to, US);
+            switch (relative_square(US, to)) {
                 case C1:
-                    move_piece(pos, A1, D1, ROOK, US);
+                    move_piece(pos, relative_square(US, A1),
+                               relative_square(US, D1), ROOK, US);
+                    key ^= piece_key(ROOK, relative_square(US, A1), US) ^
+                           piece_key(ROOK, relative_square(US, D1), US);
                     break;
                 case G1:
-                    move_piece(pos, H1, F1, ROOK, US);
+                    move_piece(pos, relative_square(US, H1),
+                               relative_square(US, F1), ROOK, US);
+                    key ^= piece_key(ROOK, relative_square(US, H1), US) ^
+                           piece_key(ROOK, relative_square(US, F1), US);
                     break;
                 default:
                     break;
             }
             break;
         case PROM_CAPTURE:
-            remove_piece(pos, to, get_piece_on_square(pos, to), THEM);
+            captured = undo.captured = get_piece_on_square(pos, to);
+            remove_piece(pos, to, captured, THEM);
             remove_piece(pos, from, PAWN, US);
             put_piece(pos, to, promotion_type(move), US);
+            key ^= piece_key(captured, to, THEM);
+            key ^= piece_key(PAWN, from, US);
+            key ^= piece_key(promotion_type(move), to, US);
+            pawn_key ^= piece_key(PAWN, from, US);
             break;
         case PROMOTION:
             remove_piece(pos, from, PAWN, US);
             put_piece(pos, to, promotion_type(move), US);
+            key ^= piece_key(PAWN, from, US);
+            key ^= piece_key(promotion_type(move), to, US);
+            pawn_key ^= piece_key(PAWN, from, US);
             break;
         default:
             std::puts("MOVE TYPE ERROR");
@@ -106,16 +170,179 @@ void make_move(Position& pos, const Move move) {
     }
 
     pos.halfmoves++;
-    if ((mt != NORMAL && mt != CASTLE) ||
-        (mt == NORMAL && get_piece_on_square(pos, to) == PAWN)) {
-        pos.history.clear();
+    if ((mt != NORMAL && mt != CASTLE) || (mt == NORMAL && piece == PAWN)) {
         pos.halfmoves = 0;
     }
 
-    flip_position(pos);
+    pos.side = THEM;
+    pos.hash_key = key;
+    pos.pawn_key = pawn_key;
+
+#ifndef NDEBUG
     calculate_key(pos);
+    assert(pos.hash_key == key);
+    assert(pos.pawn_key == pawn_key);
+
+    const Score psq[2] = {pos.psq[WHITE], pos.psq[BLACK]};
+    const std::uint8_t phase[2] = {pos.phase[WHITE], pos.phase[BLACK]};
+    calculate_psq(pos);
+    assert(pos.psq[WHITE] == psq[WHITE] && pos.psq[BLACK] == psq[BLACK]);
+    assert(pos.phase[WHITE] == phase[WHITE] &&
+           pos.phase[BLACK] == phase[BLACK]);
+#endif
+}
+
+void make_move(Position& pos, const Move move, Undo& undo) {
+    if (pos.side == WHITE) {
+        make_move<WHITE>(pos, move, undo);
+    } else {
+        make_move<BLACK>(pos, move, undo);
+    }
+}
+
+/* Take back a move made by US. */
+template <Colour US>
+void unmake_move(Position& pos, const Move move, const Undo& undo) {
+    constexpr Colour THEM = ~US;
+    const Square from = from_square(move), to = to_square(move);
+
+    switch (move_type(move)) {
+        case NORMAL:
+        case DOUBLE_PUSH:
+            move_piece(pos, to, from, undo.piece, US);
+            break;
+        case CAPTURE:
+            move_piece(pos, to, from, undo.piece, US);
+            put_piece(pos, to, undo.captured, THEM);
+            break;
+        case ENPASSANT:
+            move_piece(pos, to, from, PAWN, US);
+            put_piece(pos, Square(to ^ 8), PAWN, THEM);
+            break;
+        case CASTLE:
+            move_piece(pos, to, from, KING, US);
+            switch (relative_square(US, to)) {
+                case C1:
+                    move_piece(pos, relative_square(US, D1),
+                               relative_square(US, A1), ROOK, US);
+                    break;
+                case G1:
+                    move_piece(pos, relative_square(US, F1),
+                               relative_square(US, H1), ROOK, US);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case PROM_CAPTURE:
+            remove_piece(pos, to, promotion_type(move), US);
+            put_piece(pos, from, PAWN, US);
+            put_piece(pos, to, undo.captured, THEM);
+            break;
+        case PROMOTION:
+            remove_piece(pos, to, promotion_type(move), US);
+            put_piece(pos, from, PAWN, US);
+            break;
+        default:
+            std::puts("MOVE TYPE ERROR");
+            break;
+    }
+
+    pos.side = US;
+    pos.castle = undo.castle;
+    pos.epsq = undo.epsq;
+    pos.halfmoves = undo.halfmoves;
+    pos.hash_key = undo.hash_key;
+    pos.pawn_key = undo.pawn_key;
+}
 
-    pos.history.push_back(pos.hash_key);
+void unmake_move(Position& pos, const Move move, const Undo& undo) {
+    if (pos.side == BLACK) {
+        unmake_move<WHITE>(pos, move, undo);
+    } else {
+        unmake_move<BLACK>(pos, move, undo);
+    }
+}
+
+/* Get the hash key the position will have after the move is made. */
+std::uint64_t key_after(const Position& pos, const Move move) {
+    const Colour us = pos.side, them = ~pos.side;
+    const Square from = from_square(move), to = to_square(move);
+    const MoveType mt = move_type(move);
+    const Piece piece = get_piece_on_square(pos, from);
+    const std::uint8_t castle =
+        pos.castle & castling_lookup[from] & castling_lookup[to];
+
+    std::uint64_t key = pos.hash_key ^ side_key;
+
+    key ^= castle_key(pos.castle) ^ castle_key(castle);
+
+    if (pos.epsq != INVALID_SQUARE) {
+        key ^= ep_keys[pos.epsq & 7];
+    }
+
+    switch (mt) {
+        case CAPTURE:
+            key ^= piece_key(get_piece_on_square(pos, to), to, them);
+            /* Fall through. */
+        case NORMAL:
+            key ^= piece_key(piece, from, us) ^ piece_key(piece, to, us);
+            break;
+        case DOUBLE_PUSH:
+            key ^= piece_key(PAWN, from, us) ^ piece_key(PAWN, to, us);
+            key ^= ep_keys[from & 7];
+            break;
+        case ENPASSANT:
+            key ^= piece_key(PAWN, from, us) ^ piece_key(PAWN, to, us);
+            key ^= piece_key(PAWN, Square(to ^ 8), them);
+            break;
+        case CASTLE:
+            key ^= piece_key(KING, from, us) ^ piece_key(KING, to, us);
+            if (relative_square(us, to) == C1) {
+                key ^= piece_key(ROOK, relative_square(us, A1), us) ^
+                       piece_key(ROOK, relative_square(us, D1), us);
+            } else if (relative_square(us, to) == G1) {
+                key ^= piece_key(ROOK, relative_square(us, H1), us) ^
+                       piece_key(ROOK, relative_square(us, F1), us);
+            }
+            break;
+        case PROM_CAPTURE:
+            key ^= piece_key(get_piece_on_square(pos, to), to, them);
+            /* Fall through. */
+        case PROMOTION:
+            key ^= piece_key(PAWN, from, us);
+            key ^= piece_key(promotion_type(move), to, us);
+            break;
+        default:
+            break;
+    }
+
+    return key;
+}
+
+/* Does a pseudo-legal move keep the mover's king out of check? */
+/* This looks at the occupancy after the move instead of making it. */
+bool is_legal(const Position& pos, const Move move) {
+    const Colour us = pos.side;
+    const Square from = from_square(move), to = to_square(move);
+
+    // Castling is only generated when the king's path is safe.
+    if (move_type(move) == CASTLE) {
+        return true;
+    }
+
+    std::uint64_t captured = 1ULL << to;
+    std::uint64_t occ = (get_occupancy(pos) ^ (1ULL << from)) | captured;
+    if (move_type(move) == ENPASSANT) {
+        captured = 1ULL << (to ^ 8);
+        occ ^= captured;
+    }
+
+    const Square king =
+        pos.board[from] == KING ? to : lsb(get_piece(pos, KING, us));
+
+    return !(attacks_to(pos, king, occ, us) & get_colour(pos, ~us) &
+             ~captured);
 }
 
 void move_to_lan(char* lan_str, const Move move) {
@@ -200,10 +427,6 @@ bool lan_to_move(const Position& pos, const char* lan_str, Move& move) {
 
     Move current_move;
     while ((current_move = next_move(ss, movecount))) {
-        if (pos.flipped) {
-            current_move = flip_move(current_move);
-        }
-
         if (from_square(current_move) == from &&
             to_square(current_move) == to) {
             // FIX ME: This is very ugly
@@ -242,7 +465,7 @@ bool pv_verify(const Position& pos, PV& pv) {
     return true;
 }
 
-void print_moves(const Position& pos) {
+void print_moves(const Position& pos, const History& history) {
     SearchStack ss[1];
     clear_ss(ss, 1);
 
@@ -256,13 +479,12 @@ void print_moves(const Position& pos) {
         Position npos = pos;
 
         make_move(npos, move);
-        if (is_checked(npos, THEM)) {
+        if (is_checked(npos, pos.side)) {
             continue;
         }
 
-        if (pos.flipped) {
-            move = flip_move(move);
-        }
+        History npos_history = history;
+        history_push(npos_history, npos);
 
         std::string mtypestr = "";
         switch (move_type(move)) {
@@ -296,8 +518,9 @@ void print_moves(const Position& pos) {
         move_to_lan(mstr, move);
         printf(
             "%i)  %s  (3-fold: %i)  (50-moves: %i)  (Check: %i)  (Type: %s)\n",
-            i + 1, mstr, is_threefold(npos), is_fifty_moves(npos),
-            is_checked(npos, US), mtypestr.c_str());
+            i + 1, mstr, is_threefold(npos, npos_history),
+            is_fifty_moves(npos),
+            is_checked(npos, npos.side), mtypestr.c_str());
         i++;
     }
 }
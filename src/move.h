@@ -27,6 +27,8 @@ SOFTWARE.
 #ifndef MOVE_H
 #define MOVE_H
 
+#include <vector>
+
 #include "position.h"
 #include "types.h"
 
@@ -98,14 +100,22 @@ inline Move get_move(Square from, Square to, MoveType move_type,
     return Move(from | (to << TO_SQ_SHIFT) | move_type | prom_type);
 }
 
-/* Flip the move by flipping the to and from squares */
-inline Move flip_move(Move const move) {
-    return get_move(
-        Square(from_square(move) ^ 56), Square(to_square(move) ^ 56),
-        MoveType(MOVE_TYPE_MASK & move), PromotionType(PROM_TYPE_MASK & move));
-}
+/* What unmake_move() needs to restore the position before a move */
+struct Undo {
+    std::uint64_t hash_key;
+    std::uint64_t pawn_key;
+    Piece piece;     // The piece that moved.
+    Piece captured;  // The piece captured, if any.
+    std::uint8_t castle;
+    Square epsq;
+    std::uint8_t halfmoves;
+};
 
 extern void make_move(Position& pos, const Move move);
+extern void make_move(Position& pos, const Move move, Undo& undo);
+extern void unmake_move(Position& pos, const Move move, const Undo& undo);
+extern std::uint64_t key_after(const Position& pos, const Move move);
+extern bool is_legal(const Position& pos, const Move move);
 extern int generate(const Position& pos, Move* ml);
 extern int generate_captures(const Position& pos, Move* ml);
 
@@ -113,6 +123,52 @@ extern void move_to_lan(char* lan_str, const Move move);
 extern bool lan_to_move(const Position& pos, const char* lan_str, Move& move);
 extern void run_move_to_lan_tests(void);
 extern bool pv_verify(const Position& pos, PV& pv);
-extern void print_moves(const Position& pos);
+extern void print_moves(const Position& pos, const History& history);
+
+/* Move making strategies for the search and perft templates. */
+/* make() returns the position after the move, which must not be used after */
+/* unmake(). State is what the strategy keeps for each ply. */
+
+/* Copy the position and make the move on the copy. */
+struct CopyMake {
+    struct State {
+        Position pos;
+    };
+
+    static Position& make(Position& pos, const Move move, State& state) {
+        state.pos = pos;
+        make_move(state.pos, move);
+        return state.pos;
+    }
+
+    static void unmake(Position&, const Move, State&) {}
+};
+
+/* Make the move in place and undo it afterwards. */
+struct MakeUnmake {
+    struct State {
+        Undo undo;
+    };
+
+    static Position& make(Position& pos, const Move move, State& state) {
+        make_move(pos, move, state.undo);
+        return pos;
+    }
+
+    static void unmake(Position& pos, const Move move, State& state) {
+        unmake_move(pos, move, state.undo);
+    }
+};
+
+/* The strategy used by the search, MAKE_UNMAKE selects the alternative. */
+#if defined(MAKE_UNMAKE)
+typedef MakeUnmake MoveStrategy;
+#else
+typedef CopyMake MoveStrategy;
+#endif
+
+/* Defined in perft.cpp for both strategies. */
+template <typename Strategy = MoveStrategy>
+std::uint64_t perft(Position& pos, int depth);
 
 #endif
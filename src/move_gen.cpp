@@ -32,175 +32,132 @@ SOFTWARE.
 #include "types.h"
 
 /* Castling occupancy masks. */
-static const std::uint64_t oo_castle_mask = (1ULL << F1) | (1ULL << G1);
-static const std::uint64_t ooo_castle_mask =
-    (1ULL << D1) | (1ULL << C1) | (1ULL << B1);
-
-/* Generic move serialisation loop. */
-template <bool captures, Piece pc = PAWN>
-void add_moves(const Position& pos, Move* ml, int& idx) {
-    std::uint64_t pieces = get_piece(pos, pc, US);
-    std::uint64_t occ = get_occupancy(pos);
-    std::uint64_t capturemask = (captures) ? get_colour(pos, THEM) : ~occ;
-    MoveType mt = captures ? CAPTURE : NORMAL;
-
-    while (pieces) {
-        Square from = lsb(pieces);
-
-        std::uint64_t attack_bb = attacks<pc>(from, occ) & capturemask;
+template <Colour US>
+static std::uint64_t oo_castle_mask() {
+    return (1ULL << relative_square(US, F1)) |
+           (1ULL << relative_square(US, G1));
+}
 
-        while (attack_bb) {
-            Square dest = lsb(attack_bb);
+template <Colour US>
+static std::uint64_t ooo_castle_mask() {
+    return (1ULL << relative_square(US, D1)) |
+           (1ULL << relative_square(US, C1)) |
+           (1ULL << relative_square(US, B1));
+}
 
-            ml[idx] = get_move(from, dest, mt);
-            idx++;
+/* Add the four promotions of a pawn move. */
+inline void add_promotions(const Square from, const Square dest,
+                           const MoveType mt, Move* ml, int& idx) {
+    ml[idx] = get_move(from, dest, mt, TO_KNIGHT);
+    idx++;
 
-            attack_bb &= attack_bb - 1;
-        }
+    ml[idx] = get_move(from, dest, mt, TO_BISHOP);
+    idx++;
 
-        pieces &= pieces - 1;
-    }
+    ml[idx] = get_move(from, dest, mt, TO_ROOK);
+    idx++;
 
-    add_moves<captures, pc + 1>(pos, ml, idx);
+    ml[idx] = get_move(from, dest, mt, TO_QUEEN);
+    idx++;
 }
 
-/* Specialisation for pawn quiets. */
+/* Pawn quiets. */
 /* (promotions, pawn pushing) */
-template <>
-void add_moves<false, PAWN>(const Position& pos, Move* ml, int& idx) {
+template <Colour US>
+void add_pawn_quiets(const Position& pos, Move* ml, int& idx) {
+    constexpr int UP = US == WHITE ? 8 : -8;
+
     std::uint64_t pawns = get_piece(pos, PAWN, US);
     std::uint64_t empty = ~get_occupancy(pos);
     std::uint64_t singles, doubles;
 
     // Single push
-    singles = (pawns << 8) & empty;
+    singles = shift<UP>(pawns) & empty;
 
     // Separate promotions
-    singles &= ~rank_mask[RANK_8];
+    singles &= ~rank_mask[relative_rank(US, RANK_8)];
 
     while (singles) {
         Square dest = lsb(singles);
 
-        ml[idx] = get_move(dest - 8, dest, NORMAL);
+        ml[idx] = get_move(dest - UP, dest, NORMAL);
         idx++;
 
         singles &= singles - 1;
     }
 
     // Double push
-    singles = ((pawns & rank_mask[RANK_2]) << 8) & empty;
-    doubles = (singles << 8) & empty;
+    singles = shift<UP>(pawns & rank_mask[relative_rank(US, RANK_2)]) & empty;
+    doubles = shift<UP>(singles) & empty;
 
     while (doubles) {
         Square dest = lsb(doubles);
 
-        ml[idx] = get_move(dest - 16, dest, DOUBLE_PUSH);
+        ml[idx] = get_move(dest - 2 * UP, dest, DOUBLE_PUSH);
         idx++;
 
         doubles &= doubles - 1;
     }
 
     // Promotions
-    singles = ((pawns & rank_mask[RANK_7]) << 8) & empty;
+    singles = shift<UP>(pawns & rank_mask[relative_rank(US, RANK_7)]) & empty;
 
     while (singles) {
         Square dest = lsb(singles);
 
-        ml[idx] = get_move(dest - 8, dest, PROMOTION, TO_KNIGHT);
-        idx++;
-
-        ml[idx] = get_move(dest - 8, dest, PROMOTION, TO_BISHOP);
-        idx++;
-
-        ml[idx] = get_move(dest - 8, dest, PROMOTION, TO_ROOK);
-        idx++;
-
-        ml[idx] = get_move(dest - 8, dest, PROMOTION, TO_QUEEN);
-        idx++;
+        add_promotions(dest - UP, dest, PROMOTION, ml, idx);
 
         singles &= singles - 1;
     }
-
-    add_moves<false, KNIGHT>(pos, ml, idx);
 }
 
-/* Specialisation for pawn captures. */
-/* (en-passant, capture-promotions) */
-template <>
-void add_moves<true, PAWN>(const Position& pos, Move* ml, int& idx) {
-    std::uint64_t pawns = get_piece(pos, PAWN, US);
-    std::uint64_t them = get_colour(pos, THEM);
+/* Pawn captures towards one side of the board. */
+/* d is the shift from a pawn to the square it captures on. */
+template <Colour US, int d, File edge>
+void add_pawn_captures(const Position& pos, Move* ml, int& idx) {
+    std::uint64_t pawns = get_piece(pos, PAWN, US) & ~file_mask[edge];
+    std::uint64_t them = get_colour(pos, ~US);
+    std::uint64_t promo = rank_mask[relative_rank(US, RANK_8)];
     std::uint64_t dest_bb;
 
-    // Left captures
-    dest_bb = ((pawns & ~file_mask[FILE_A]) << 7) & them & ~rank_mask[RANK_8];
+    // Captures
+    dest_bb = shift<d>(pawns) & them & ~promo;
 
     while (dest_bb) {
         Square dest = lsb(dest_bb);
 
-        ml[idx] = get_move(dest - 7, dest, CAPTURE);
+        ml[idx] = get_move(dest - d, dest, CAPTURE);
         idx++;
 
         dest_bb &= dest_bb - 1;
     }
 
-    // Left capture-promotions
-    dest_bb = ((pawns & ~file_mask[FILE_A]) << 7) & them & rank_mask[RANK_8];
+    // Capture-promotions
+    dest_bb = shift<d>(pawns) & them & promo;
 
     while (dest_bb) {
         Square dest = lsb(dest_bb);
 
-        ml[idx] = get_move(dest - 7, dest, PROM_CAPTURE, TO_KNIGHT);
-        idx++;
-
-        ml[idx] = get_move(dest - 7, dest, PROM_CAPTURE, TO_BISHOP);
-        idx++;
-
-        ml[idx] = get_move(dest - 7, dest, PROM_CAPTURE, TO_ROOK);
-        idx++;
-
-        ml[idx] = get_move(dest - 7, dest, PROM_CAPTURE, TO_QUEEN);
-        idx++;
-
-        dest_bb &= dest_bb - 1;
-    }
-
-    // Right captures
-    dest_bb = ((pawns & ~file_mask[FILE_H]) << 9) & them & ~rank_mask[RANK_8];
-
-    while (dest_bb) {
-        Square dest = lsb(dest_bb);
-
-        ml[idx] = get_move(dest - 9, dest, CAPTURE);
-        idx++;
+        add_promotions(dest - d, dest, PROM_CAPTURE, ml, idx);
 
         dest_bb &= dest_bb - 1;
     }
+}
 
-    // Right capture-promotions
-    dest_bb = ((pawns & ~file_mask[FILE_H]) << 9) & them & rank_mask[RANK_8];
-
-    while (dest_bb) {
-        Square dest = lsb(dest_bb);
-
-        ml[idx] = get_move(dest - 9, dest, PROM_CAPTURE, TO_KNIGHT);
-        idx++;
-
-        ml[idx] = get_move(dest - 9, dest, PROM_CAPTURE, TO_BISHOP);
-        idx++;
-
-        ml[idx] = get_move(dest - 9, dest, PROM_CAPTURE, TO_ROOK);
-        idx++;
-
-        ml[idx] = get_move(dest - 9, dest, PROM_CAPTURE, TO_QUEEN);
-        idx++;
+/* Pawn captures. */
+/* (en-passant, capture-promotions) */
+template <Colour US>
+void add_pawn_captures(const Position& pos, Move* ml, int& idx) {
+    constexpr int LEFT = US == WHITE ? 7 : -9;
+    constexpr int RIGHT = US == WHITE ? 9 : -7;
 
-        dest_bb &= dest_bb - 1;
-    }
+    add_pawn_captures<US, LEFT, FILE_A>(pos, ml, idx);
+    add_pawn_captures<US, RIGHT, FILE_H>(pos, ml, idx);
 
     // En passant
     if (pos.epsq != INVALID_SQUARE) {
-        pawns &= pawn_attacks(pos.epsq, THEM);
+        std::uint64_t pawns =
+            get_piece(pos, PAWN, US) & pawn_attacks(pos.epsq, ~US);
 
         while (pawns) {
             Square from = lsb(pawns);
@@ -211,14 +168,40 @@ void add_moves<true, PAWN>(const Position& pos, Move* ml, int& idx) {
             pawns &= pawns - 1;
         }
     }
+}
+
+/* Generic move serialisation loop for knights, bishops, rooks and queens. */
+template <Colour US, bool captures, Piece pc>
+void add_piece_moves(const Position& pos, Move* ml, int& idx) {
+    std::uint64_t pieces = get_piece(pos, pc, US);
+    std::uint64_t occ = get_occupancy(pos);
+    std::uint64_t capturemask = (captures) ? get_colour(pos, ~US) : ~occ;
+    MoveType mt = captures ? CAPTURE : NORMAL;
+
+    while (pieces) {
+        Square from = lsb(pieces);
+
+        std::uint64_t attack_bb = attacks<pc>(from, occ) & capturemask;
+
+        while (attack_bb) {
+            Square dest = lsb(attack_bb);
+
+            ml[idx] = get_move(from, dest, mt);
+            idx++;
+
+            attack_bb &= attack_bb - 1;
+        }
+
+        pieces &= pieces - 1;
+    }
 
-    add_moves<true, KNIGHT>(pos, ml, idx);
 }
 
-/* Specialisation for king quiets. */
-/* (Castling, plus an end to the recursion) */
-template <>
-void add_moves<false, KING>(const Position& pos, Move* ml, int& idx) {
+/* King quiets. */
+/* (Castling) */
+template <Colour US>
+void add_king_quiets(const Position& pos, Move* ml, int& idx) {
+    constexpr Colour THEM = ~US;
     std::uint64_t occ = get_occupancy(pos);
 
     Square from = lsb(get_piece(pos, KING, US));
@@ -234,34 +217,42 @@ void add_moves<false, KING>(const Position& pos, Move* ml, int& idx) {
         attack_bb &= attack_bb - 1;
     }
 
-    if (!is_checked(pos, US)) {
-        if (pos.castle & US_OO && !(occ & oo_castle_mask) &&
-            !(attacks_to<>(pos, F1, occ, US) & get_colour(pos, THEM)) &&
-            !(attacks_to<>(pos, G1, occ, US) & get_colour(pos, THEM))) {
-            ml[idx] = get_move(E1, G1, CASTLE);
+    constexpr std::uint8_t OO = US == WHITE ? WHITE_OO : BLACK_OO;
+    constexpr std::uint8_t OOO = US == WHITE ? WHITE_OOO : BLACK_OOO;
+
+    if ((pos.castle & (OO | OOO)) && !is_checked(pos, US)) {
+        constexpr Square C = relative_square(US, C1);
+        constexpr Square D = relative_square(US, D1);
+        constexpr Square E = relative_square(US, E1);
+        constexpr Square F = relative_square(US, F1);
+        constexpr Square G = relative_square(US, G1);
+
+        if (pos.castle & OO && !(occ & oo_castle_mask<US>()) &&
+            !(attacks_to<>(pos, F, occ, US) & get_colour(pos, THEM)) &&
+            !(attacks_to<>(pos, G, occ, US) & get_colour(pos, THEM))) {
+            ml[idx] = get_move(E, G, CASTLE);
             idx++;
         }
 
-        if (pos.castle & US_OOO && !(occ & ooo_castle_mask) &&
-            !(attacks_to<>(pos, D1, occ, US) & get_colour(pos, THEM)) &&
-            !(attacks_to<>(pos, C1, occ, US) & get_colour(pos, THEM))) {
-            ml[idx] = get_move(E1, C1, CASTLE);
+        if (pos.castle & OOO && !(occ & ooo_castle_mask<US>()) &&
+            !(attacks_to<>(pos, D, occ, US) & get_colour(pos, THEM)) &&
+            !(attacks_to<>(pos, C, occ, US) & get_colour(pos, THEM))) {
+            ml[idx] = get_move(E, C, CASTLE);
             idx++;
         }
     }
-
-    // No tail call to end template recursion.
 }
 
-/* Specialisation for king captures. */
+/* King captures. */
 /* Maybe worth checking for illegal moves? */
-template <>
-void add_moves<true, KING>(const Position& pos, Move* ml, int& idx) {
-    std::uint64_t occ = get_colour(pos, US) | get_colour(pos, THEM);
+template <Colour US>
+void add_king_captures(const Position& pos, Move* ml, int& idx) {
+    std::uint64_t occ = get_occupancy(pos);
 
     Square from = lsb(get_piece(pos, KING, US));
 
-    std::uint64_t attack_bb = attacks<KING>(from, occ) & get_colour(pos, THEM);
+    std::uint64_t attack_bb =
+        attacks<KING>(from, occ) & get_colour(pos, ~US);
 
     while (attack_bb) {
         Square dest = lsb(attack_bb);
@@ -271,16 +262,41 @@ void add_moves<true, KING>(const Position& pos, Move* ml, int& idx) {
 
         attack_bb &= attack_bb - 1;
     }
+}
+
+/* Generate captures for a side. */
+template <Colour US>
+void add_captures(const Position& pos, Move* ml, int& idx) {
+    add_pawn_captures<US>(pos, ml, idx);
+    add_piece_moves<US, true, KNIGHT>(pos, ml, idx);
+    add_piece_moves<US, true, BISHOP>(pos, ml, idx);
+    add_piece_moves<US, true, ROOK>(pos, ml, idx);
+    add_piece_moves<US, true, QUEEN>(pos, ml, idx);
+    add_king_captures<US>(pos, ml, idx);
+}
 
-    // No tail call to end template recursion.
+/* Generate quiet moves for a side. */
+template <Colour US>
+void add_quiets(const Position& pos, Move* ml, int& idx) {
+    add_pawn_quiets<US>(pos, ml, idx);
+    add_piece_moves<US, false, KNIGHT>(pos, ml, idx);
+    add_piece_moves<US, false, BISHOP>(pos, ml, idx);
+    add_piece_moves<US, false, ROOK>(pos, ml, idx);
+    add_piece_moves<US, false, QUEEN>(pos, ml, idx);
+    add_king_quiets<US>(pos, ml, idx);
 }
 
 /* Generate moves for a position. */
 int generate(const Position& pos, Move* ml) {
     int idx = 0;
 
-    add_moves<true>(pos, ml, idx);
-    add_moves<false>(pos, ml, idx);
+    if (pos.side == WHITE) {
+        add_captures<WHITE>(pos, ml, idx);
+        add_quiets<WHITE>(pos, ml, idx);
+    } else {
+        add_captures<BLACK>(pos, ml, idx);
+        add_quiets<BLACK>(pos, ml, idx);
+    }
 
     return idx;
 }
@@ -289,7 +305,11 @@ int generate(const Position& pos, Move* ml) {
 int generate_captures(const Position& pos, Move* ml) {
     int idx = 0;
 
-    add_moves<true>(pos, ml, idx);
+    if (pos.side == WHITE) {
+        add_captures<WHITE>(pos, ml, idx);
+    } else {
+        add_captures<BLACK>(pos, ml, idx);
+    }
 
     return idx;
 }
@@ -0,0 +1,424 @@
+/*
+MIT License
+
+Copyright (c) 2017 CPirc
+Copyright (c) 2018 CPirc
+Copyright (c) 2019 CPirc
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "nnue.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "bitboard.h"
+#include "misc.h"
+
+#if defined(__GNUC__)
+#define NNUE_INLINE inline __attribute__((always_inline))
+#else
+#define NNUE_INLINE inline
+#endif
+
+/* The loaded network, pointing into the file mapping or a copy of it */
+struct Network {
+    const std::int16_t* feature_weights;  // [NNUE_FEATURES][NNUE_HIDDEN]
+    const std::int16_t* feature_biases;   // [NNUE_HIDDEN]
+    const std::int16_t* output_weights;   // [2][NNUE_HIDDEN]
+    std::int32_t output_bias;
+    std::int32_t scale;
+    void* memory;              // Allocation backing the weights, if any.
+    void* mapping;             // Mapping backing the weights, if any.
+    std::size_t mapping_size;  // Size of the mapping.
+};
+
+static Network net = {};
+
+bool use_nnue = false;
+
+/* Get the feature of a piece on a square seen from one side. */
+NNUE_INLINE int feature(const Colour perspective, const Square ksq,
+                        const Piece piece, const Colour colour,
+                        const Square sq) {
+    assert(piece < KING);
+    const int k = relative_square(perspective, ksq);
+    const int s = relative_square(perspective, sq);
+    return (k * 10 + piece * 2 + (colour != perspective)) * 64 + s;
+}
+
+/* Get the weights of a feature. */
+NNUE_INLINE const std::int16_t* weights_of(const int index) {
+    return net.feature_weights + index * NNUE_HIDDEN;
+}
+
+/* Add the weights of a feature to one side of an accumulator. */
+NNUE_INLINE void add_weights(std::int16_t* values,
+                             const std::int16_t* weights) {
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+        values[i] += weights[i];
+    }
+}
+
+/* Subtract the weights of a feature from one side of an accumulator. */
+NNUE_INLINE void sub_weights(std::int16_t* values,
+                             const std::int16_t* weights) {
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+        values[i] -= weights[i];
+    }
+}
+
+/* Compute one side of an accumulator from the pieces on the board. */
+NNUE_INLINE void refresh_side(const Position& pos, Accumulator& acc,
+                              const Colour perspective) {
+    std::int16_t* values = acc.values[perspective];
+    std::memcpy(values, net.feature_biases, sizeof(acc.values[perspective]));
+
+    const Square ksq = lsb(pos.pieces[KING] & pos.colours[perspective]);
+    for (int c = WHITE; c <= BLACK; ++c) {
+        std::uint64_t bb = pos.colours[c] & ~pos.pieces[KING];
+        while (bb) {
+            const Square sq = lsb(bb);
+            bb &= bb - 1;
+            add_weights(values, weights_of(feature(perspective, ksq,
+                                                   pos.board[sq], Colour(c),
+                                                   sq)));
+        }
+    }
+}
+
+NNUE_INLINE void refresh_impl(const Position& pos, Accumulator& acc) {
+    refresh_side(pos, acc, WHITE);
+    refresh_side(pos, acc, BLACK);
+}
+
+/* Bring an accumulator from the position before the last move up to date */
+/* with the pieces the move changed. Moving a king changes every feature of */
+/* its side, so that side is computed afresh. */
+NNUE_INLINE void update_impl(const Position& pos, const DirtyPieces& dirty,
+                             const Accumulator& parent, Accumulator& acc) {
+    for (int c = WHITE; c <= BLACK; ++c) {
+        const Colour perspective = Colour(c);
+
+        bool king_moved = false;
+        for (int i = 0; i < dirty.count; ++i) {
+            king_moved |= dirty.pieces[i].piece == KING &&
+                          dirty.pieces[i].colour == perspective;
+        }
+        if (king_moved) {
+            refresh_side(pos, acc, perspective);
+            continue;
+        }
+
+        const Square ksq = lsb(pos.pieces[KING] & pos.colours[perspective]);
+        const std::int16_t* added[3];
+        const std::int16_t* removed[3];
+        int adds = 0, subs = 0;
+        for (int i = 0; i < dirty.count; ++i) {
+            const DirtyPiece& piece = dirty.pieces[i];
+            if (piece.piece == KING) {
+                continue;
+            }
+            if (piece.from != INVALID_SQUARE) {
+                removed[subs++] = weights_of(feature(
+                    perspective, ksq, piece.piece, piece.colour, piece.from));
+            }
+            if (piece.to != INVALID_SQUARE) {
+                added[adds++] = weights_of(feature(
+                    perspective, ksq, piece.piece, piece.colour, piece.to));
+            }
+        }
+
+        // Quiet moves and captures are done in a single pass.
+        const std::int16_t* from = parent.values[perspective];
+        std::int16_t* values = acc.values[perspective];
+        if (adds == 1 && subs == 1) {
+            for (int i = 0; i < NNUE_HIDDEN; ++i) {
+                values[i] = from[i] + added[0][i] - removed[0][i];
+            }
+        } else if (adds == 1 && subs == 2) {
+            for (int i = 0; i < NNUE_HIDDEN; ++i) {
+                values[i] =
+                    from[i] + added[0][i] - removed[0][i] - removed[1][i];
+            }
+        } else {
+            std::memcpy(values, from, sizeof(acc.values[perspective]));
+            for (int i = 0; i < subs; ++i) {
+                sub_weights(values, removed[i]);
+            }
+            for (int i = 0; i < adds; ++i) {
+                add_weights(values, added[i]);
+            }
+        }
+    }
+}
+
+/* Run the clipped first layer of both sides through the output neuron. */
+NNUE_INLINE int output_impl(const Accumulator& acc, const Colour side) {
+    const std::int16_t* us = acc.values[side];
+    const std::int16_t* them = acc.values[~side];
+    const std::int16_t* weights = net.output_weights;
+
+    std::int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+        const std::int16_t v = std::min<std::int16_t>(
+            std::max<std::int16_t>(us[i], 0), 127);
+        sum += v * weights[i];
+    }
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+        const std::int16_t v = std::min<std::int16_t>(
+            std::max<std::int16_t>(them[i], 0), 127);
+        sum += v * weights[NNUE_HIDDEN + i];
+    }
+
+    return sum + net.output_bias;
+}
+
+/* The accumulator and output loops, compiled for an instruction set */
+struct NNUEKernels {
+    void (*refresh)(const Position&, Accumulator&);
+    void (*update)(const Position&, const DirtyPieces&, const Accumulator&,
+                   Accumulator&);
+    int (*output)(const Accumulator&, const Colour);
+};
+
+/* The baseline build vectorises these with SSE2 on x86-64. */
+static void refresh_generic(const Position& pos, Accumulator& acc) {
+    refresh_impl(pos, acc);
+}
+
+static void update_generic(const Position& pos, const DirtyPieces& dirty,
+                           const Accumulator& parent, Accumulator& acc) {
+    update_impl(pos, dirty, parent, acc);
+}
+
+static int output_generic(const Accumulator& acc, const Colour side) {
+    return output_impl(acc, side);
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("avx2")))
+static void refresh_avx2(const Position& pos, Accumulator& acc) {
+    refresh_impl(pos, acc);
+}
+
+__attribute__((target("avx2")))
+static void update_avx2(const Position& pos, const DirtyPieces& dirty,
+                        const Accumulator& parent, Accumulator& acc) {
+    update_impl(pos, dirty, parent, acc);
+}
+
+__attribute__((target("avx2")))
+static int output_avx2(const Accumulator& acc, const Colour side) {
+    return output_impl(acc, side);
+}
+#endif
+
+/* Use the widest vectors the CPU has. */
+static NNUEKernels pick_kernels() {
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return NNUEKernels{refresh_avx2, update_avx2, output_avx2};
+    }
+#endif
+    return NNUEKernels{refresh_generic, update_generic, output_generic};
+}
+
+static const NNUEKernels kernels = pick_kernels();
+
+/* Point the network at weights following a header in memory. */
+static void nnue_set(const NNUEFileHeader& header, const char* base) {
+    const std::int16_t* weights =
+        (const std::int16_t*)(base + sizeof(NNUEFileHeader));
+
+    net.feature_weights = weights;
+    net.feature_biases = weights + NNUE_FEATURES * NNUE_HIDDEN;
+    net.output_weights = net.feature_biases + NNUE_HIDDEN;
+    std::memcpy(&net.output_bias, net.output_weights + 2 * NNUE_HIDDEN,
+                sizeof(net.output_bias));
+    net.scale = header.scale;
+    use_nnue = true;
+}
+
+/* Load a network, replacing any loaded before. */
+/* On failure the loaded network, if any, is kept. */
+bool nnue_load(const char* path) {
+    assert(path);
+
+    FILE* f = std::fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    NNUEFileHeader header;
+    if (std::fread(&header, sizeof(header), 1, f) != 1 ||
+        header.magic != NNUE_FILE_MAGIC ||
+        header.version != NNUE_FILE_VERSION ||
+        header.features != NNUE_FEATURES || header.hidden != NNUE_HIDDEN ||
+        header.scale <= 0) {
+        std::fclose(f);
+        return false;
+    }
+
+    const std::size_t bytes =
+        sizeof(header) +
+        (NNUE_FEATURES * NNUE_HIDDEN + 3 * NNUE_HIDDEN) * sizeof(std::int16_t) +
+        sizeof(std::int32_t);
+
+#if !defined(_WIN32)
+    // Map the file read only, so several engines on a machine share the
+    // weights in the page cache.
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0 && (std::size_t)st.st_size >= bytes) {
+        void* mapping =
+            mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+
+        if (mapping != MAP_FAILED) {
+            std::fclose(f);
+
+            nnue_unload();
+            net.mapping = mapping;
+            net.mapping_size = bytes;
+            nnue_set(header, (const char*)mapping);
+            return true;
+        }
+    }
+#endif
+
+    // Fall back to reading the weights into memory.
+    char* memory = (char*)malloc(bytes);
+    if (!memory ||
+        std::fread(memory + sizeof(header), bytes - sizeof(header), 1, f) !=
+            1) {
+        free(memory);
+        std::fclose(f);
+        return false;
+    }
+    std::fclose(f);
+
+    nnue_unload();
+    net.memory = memory;
+    nnue_set(header, memory);
+    return true;
+}
+
+/* Go back to the hand-written evaluation. */
+void nnue_unload() {
+#if !defined(_WIN32)
+    if (net.mapping) {
+        munmap(net.mapping, net.mapping_size);
+    }
+#endif
+    free(net.memory);
+    net = Network();
+    use_nnue = false;
+}
+
+/* Compute an accumulator from the pieces on the board. */
+void nnue_refresh(const Position& pos, Accumulator& acc) {
+    assert(use_nnue);
+    kernels.refresh(pos, acc);
+}
+
+/* Record a piece a move changes. */
+inline void add_dirty(DirtyPieces& dirty, const Piece piece,
+                      const Colour colour, const Square from,
+                      const Square to) {
+    assert(dirty.count < 3);
+    dirty.pieces[dirty.count++] = DirtyPiece{piece, colour, from, to};
+}
+
+/* Get the pieces a move will change, before it is made. This follows */
+/* make_move(), as key_after() does. */
+void nnue_dirty(const Position& pos, const Move move, DirtyPieces& dirty) {
+    const Colour us = pos.side, them = ~pos.side;
+    const Square from = from_square(move), to = to_square(move);
+    const Piece piece = get_piece_on_square(pos, from);
+
+    dirty.count = 0;
+    switch (move_type(move)) {
+        case CAPTURE:
+            add_dirty(dirty, get_piece_on_square(pos, to), them, to,
+                      INVALID_SQUARE);
+            /* Fall through. */
+        case NORMAL:
+        case DOUBLE_PUSH:
+            add_dirty(dirty, piece, us, from, to);
+            break;
+        case ENPASSANT:
+            add_dirty(dirty, PAWN, them, Square(to ^ 8), INVALID_SQUARE);
+            add_dirty(dirty, PAWN, us, from, to);
+            break;
+        case CASTLE:
+            add_dirty(dirty, KING, us, from, to);
+            if (relative_square(us, to) == C1) {
+                add_dirty(dirty, ROOK, us, relative_square(us, A1),
+                          relative_square(us, D1));
+            } else if (relative_square(us, to) == G1) {
+                add_dirty(dirty, ROOK, us, relative_square(us, H1),
+                          relative_square(us, F1));
+            }
+            break;
+        case PROM_CAPTURE:
+            add_dirty(dirty, get_piece_on_square(pos, to), them, to,
+                      INVALID_SQUARE);
+            /* Fall through. */
+        case PROMOTION:
+            add_dirty(dirty, PAWN, us, from, INVALID_SQUARE);
+            add_dirty(dirty, promotion_type(move), us, INVALID_SQUARE,
+                      to);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Compute the accumulator of a position from the one of the position */
+/* before the last move made on it, and the pieces that move changed. */
+void nnue_update(const Position& pos, const DirtyPieces& dirty,
+                 const Accumulator& parent, Accumulator& acc) {
+    assert(use_nnue);
+    kernels.update(pos, dirty, parent, acc);
+}
+
+/* Evaluate a position for the side to move with the network. */
+int nnue_evaluate(const Position& pos, const Accumulator& acc) {
+    assert(use_nnue);
+
+#ifndef NDEBUG
+    Accumulator fresh;
+    nnue_refresh(pos, fresh);
+    assert(std::memcmp(&fresh, &acc, sizeof(acc)) == 0);
+#endif
+
+    const int eval = kernels.output(acc, pos.side) / net.scale;
+
+    // Keep clear of mate scores.
+    return std::max(-INF + MAX_PLY + 1, std::min(INF - MAX_PLY - 1, eval));
+}
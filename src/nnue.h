@@ -0,0 +1,91 @@
+/*
+MIT License
+
+Copyright (c) 2017 CPirc
+Copyright (c) 2018 CPirc
+Copyright (c) 2019 CPirc
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef NNUE_H
+#define NNUE_H
+
+#include <cstdint>
+
+#include "move.h"
+#include "position.h"
+
+/* HalfKP features: the square of the own king, then each non-king piece */
+/* and square, all seen from one side of the board */
+#define NNUE_FEATURES (64 * 10 * 64)
+
+/* Neurons of the first layer, for each side */
+#define NNUE_HIDDEN (256)
+
+/* Network file format */
+#define NNUE_FILE_MAGIC (0x004E4E5F4F4E4F4DULL)  // "MONO_NN"
+#define NNUE_FILE_VERSION (1)
+
+/* The header of a network file. It is followed by the int16 feature */
+/* weights and biases, the int16 output weights for the side to move and */
+/* the other side, and the int32 output bias. */
+struct NNUEFileHeader {
+    std::uint64_t magic;
+    std::uint32_t version;
+    std::uint32_t features;
+    std::uint32_t hidden;
+    std::int32_t scale;  // Divides the output to give centipawns.
+    std::uint8_t padding[40];
+};
+
+/* The first layer of the network for each side, kept up to date with the */
+/* pieces a move changes rather than computed afresh. */
+struct alignas(32) Accumulator {
+    std::int16_t values[2][NNUE_HIDDEN];
+};
+
+/* A piece a move put, removed or moved. From is INVALID_SQUARE for a piece */
+/* put on the board and to is INVALID_SQUARE for a piece removed. */
+struct DirtyPiece {
+    Piece piece;
+    Colour colour;
+    Square from;
+    Square to;
+};
+
+/* The pieces a move changes, of which there are at most three */
+struct DirtyPieces {
+    DirtyPiece pieces[3];
+    int count;
+};
+
+/* Is a network loaded? Otherwise the hand-written evaluation is used. */
+extern bool use_nnue;
+
+extern bool nnue_load(const char* path);
+extern void nnue_unload();
+extern void nnue_refresh(const Position& pos, Accumulator& acc);
+extern void nnue_dirty(const Position& pos, const Move move,
+                       DirtyPieces& dirty);
+extern void nnue_update(const Position& pos, const DirtyPieces& dirty,
+                        const Accumulator& parent, Accumulator& acc);
+extern int nnue_evaluate(const Position& pos, const Accumulator& acc);
+
+#endif
@@ -24,67 +24,189 @@
  * SOFTWARE.
  */
 
+#include <atomic>
 #include <cassert>
 #include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 #include "bitboard.h"
 #include "move.h"
 #include "position.h"
 
-std::uint64_t perft(const Position& pos, const int depth) {
+/* Count the legal moves of a position without making them. */
+static std::uint64_t count_legal(const Position& pos) {
+    std::uint64_t nodes = 0;
+    Move moves[256];
+    int movecount = generate(pos, moves);
+    for (int i = 0; i < movecount; i++) {
+        nodes += is_legal(pos, moves[i]);
+    }
+    return nodes;
+}
+
+template <typename Strategy>
+std::uint64_t perft(Position& pos, const int depth) {
     if (depth == 0) {
         return 1;
     }
 
+    // The leaves are the legal moves, which don't need making to count.
+    if (depth == 1) {
+        return count_legal(pos);
+    }
+
     uint64_t nodes = 0;
     Move moves[256];
     int movecount = generate(pos, moves);
 
+    typename Strategy::State state;
     for (int i = 0; i < movecount; i++) {
-        Position npos = pos;
-
-        make_move(npos, moves[i]);
-        if (is_checked(npos, THEM)) continue;
-
-        nodes += perft(npos, depth - 1);
+#ifndef NDEBUG
+        const Position before = pos;
+#endif
+        Position& npos = Strategy::make(pos, moves[i], state);
+        assert(npos.hash_key == key_after(before, moves[i]));
+        assert(is_legal(before, moves[i]) == !is_checked(npos, ~npos.side));
+
+        if (!is_checked(npos, ~npos.side)) {
+            nodes += perft<Strategy>(npos, depth - 1);
+        }
+
+        Strategy::unmake(pos, moves[i], state);
+        assert(std::memcmp(&pos, &before, sizeof(Position)) == 0);
     }
 
     return nodes;
 }
 
-std::uint64_t perft_tt(TT* tt, const Position& pos, const int depth) {
+template std::uint64_t perft<CopyMake>(Position& pos, const int depth);
+template std::uint64_t perft<MakeUnmake>(Position& pos, const int depth);
+
+/* Hash the position independently of the Zobrist keys, so that the perft */
+/* table can check 128 bits of key when built with PERFT_TT_CHECK. */
+static std::uint64_t perft_check_key(const Position& pos) {
+#if defined(PERFT_TT_CHECK)
+    std::uint64_t check = 0;
+    auto mix = [&check](std::uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        check = (check ^ x ^ (x >> 31)) * 0x9E3779B97F4A7C15ULL;
+    };
+
+    for (int i = 0; i < 6; ++i) {
+        mix(pos.pieces[i]);
+    }
+    mix(pos.colours[WHITE]);
+    mix(pos.castle | (pos.epsq << 4) | (pos.side << 12));
+
+    return check;
+#else
+    (void)pos;
+    return 0;
+#endif
+}
+
+std::uint64_t perft_tt(PerftTT* tt, const Position& pos, const int depth) {
     assert(tt);
 
     if (depth == 0) {
         return 1;
     }
 
-    TTEntry entry = tt_poll(tt, pos.hash_key);
-    if (entry.hash_key == pos.hash_key && tt_depth(entry.data) == depth) {
-        return tt_nodes(entry.data);
+    // Counting the legal moves is cheaper than a table probe.
+    if (depth == 1) {
+        return count_legal(pos);
     }
 
     uint64_t nodes = 0;
+    const std::uint64_t check = perft_check_key(pos);
+    if (perft_tt_poll(tt, pos.hash_key, check, depth, nodes)) {
+        return nodes;
+    }
+
     Move moves[256];
     int movecount = generate(pos, moves);
     for (int i = 0; i < movecount; i++) {
         Position npos = pos;
 
         make_move(npos, moves[i]);
-        if (is_checked(npos, THEM)) continue;
+        if (is_checked(npos, ~npos.side)) continue;
 
         nodes += perft_tt(tt, npos, depth - 1);
     }
 
-    tt_add_perft(tt, pos.hash_key, depth, nodes);
+    perft_tt_add(tt, pos.hash_key, check, depth, nodes);
 
     return nodes;
 }
 
-void run_perft_tests() {
-    Position pos;
-    parse_fen_to_position((const char*)"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", pos);
-    for (int i = 1; i <= 6; i++) {
-        std::printf("Perft(%d) = %" PRIu64 "\n", i, perft(pos, i));
+/* Collect the positions split plies below a position, once per path. */
+static void perft_split(const Position& pos, const int split,
+                        std::vector<Position>& positions) {
+    if (split == 0) {
+        positions.push_back(pos);
+        return;
+    }
+
+    Move moves[256];
+    int movecount = generate(pos, moves);
+    for (int i = 0; i < movecount; i++) {
+        Position npos = pos;
+
+        make_move(npos, moves[i]);
+        if (is_checked(npos, ~npos.side)) continue;
+
+        perft_split(npos, split - 1, positions);
+    }
+}
+
+/* Count the leaves with several threads, which take the subtrees below the */
+/* split ply from a shared list and share the perft table. */
+std::uint64_t perft_parallel(PerftTT* tt, const Position& pos, const int depth,
+                             const int threads, int split) {
+    assert(tt);
+    assert(threads > 0);
+
+    if (depth == 0) {
+        return 1;
+    }
+
+    // Leave at least a ply below the split for the workers.
+    if (split > depth - 1) {
+        split = depth - 1;
+    }
+    if (split < 0) {
+        split = 0;
+    }
+
+    std::vector<Position> positions;
+    perft_split(pos, split, positions);
+
+    std::vector<std::uint64_t> counts(positions.size());
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        std::size_t i;
+        while ((i = next++) < positions.size()) {
+            counts[i] = perft_tt(tt, positions[i], depth - split);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; ++i) {
+        workers.emplace_back(worker);
     }
+    worker();
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+
+    std::uint64_t nodes = 0;
+    for (const std::uint64_t count : counts) {
+        nodes += count;
+    }
+
+    return nodes;
 }
@@ -24,9 +24,12 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <cassert>
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <utility>
 
 #include "bitboard.h"
 #include "eval.h"
@@ -46,62 +49,182 @@ static const unsigned char fen_board[] = {
     A1, B1, C1, D1, E1, F1, G1, H1
 };
 
-/* The zobrist keys used to hash the position */
-std::uint64_t piece_sq_keys[6][64];
-std::uint64_t castle_keys[16];
-std::uint64_t ep_keys[8];
-std::uint64_t flip_key;
-
-/* Initialize the zobrist keys */
-void init_keys() {
-    int i, j;
-    for (i = 0; i < 16; ++i) {
-        castle_keys[i] = get_rand64();
+/* Get a zobrist key as the nth output of SplitMix64, which needs no state */
+/* so the keys can be generated at compile time. */
+static constexpr std::uint64_t zobrist_key(const int n) {
+    std::uint64_t z = 0x10C7F5AD7D5C8D33ULL + (n + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+template <int N>
+static constexpr Table<std::uint64_t, N> make_keys(const int first) {
+    Table<std::uint64_t, N> keys{};
+    for (int i = 0; i < N; ++i) {
+        keys[i] = zobrist_key(first + i);
     }
-    for (i = 0; i < 6; ++i) {
-        for (j = 0; j < 64; ++j) {
-            piece_sq_keys[i][j] = get_rand64();
-        }
+    return keys;
+}
+
+static constexpr Table<Table<std::uint64_t, 64>, 6> make_piece_sq_keys(
+    const int first) {
+    Table<Table<std::uint64_t, 64>, 6> keys{};
+    for (int i = 0; i < 6; ++i) {
+        keys[i] = make_keys<64>(first + 64 * i);
     }
-    for (i = 0; i < 8; i++) {
-        ep_keys[i] = get_rand64();
+    return keys;
+}
+
+/* The zobrist keys used to hash the position */
+constexpr Table<std::uint64_t, 16> castle_keys = make_keys<16>(0);
+constexpr Table<Table<std::uint64_t, 64>, 6> piece_sq_keys =
+    make_piece_sq_keys(16);
+constexpr Table<std::uint64_t, 8> ep_keys = make_keys<8>(16 + 6 * 64);
+constexpr std::uint64_t side_key = zobrist_key(16 + 6 * 64 + 8);
+
+/* Cuckoo tables of the keys of reversible moves, with the squares moved */
+/* between, as described by Marcel van Kervinck. */
+#define CUCKOO_SIZE (8192)
+static std::uint64_t cuckoo_keys[CUCKOO_SIZE];
+static Square cuckoo_squares[CUCKOO_SIZE][2];
+
+/* The keys of moves sharing a square are related by XOR, so the slots come */
+/* from multiplying the key rather than from its raw bits. */
+inline int cuckoo_h1(const std::uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15ULL) >> 51;
+}
+
+inline int cuckoo_h2(const std::uint64_t key) {
+    return (key * 0xD6E8FEB86659FD93ULL) >> 51;
+}
+
+/* Get the squares a piece attacks on an empty board. */
+static std::uint64_t pseudo_attacks(const Piece pc, const Square sq) {
+    switch (pc) {
+        case KNIGHT:
+            return attacks<KNIGHT>(sq, 0);
+        case BISHOP:
+            return attacks<BISHOP>(sq, 0);
+        case ROOK:
+            return attacks<ROOK>(sq, 0);
+        case QUEEN:
+            return attacks<QUEEN>(sq, 0);
+        case KING:
+            return attacks<KING>(sq, 0);
+        default:
+            return 0;
     }
-    flip_key = get_rand64();
 }
 
-void calculate_key(Position &pos) {
-    std::uint64_t pieces;
+/* Fill the cuckoo tables with every reversible piece move. */
+/* This needs the zobrist keys and the attack tables. */
+void init_cuckoo() {
+    int count = 0;
 
-    pos.hash_key = 0;
-    pieces = get_colour(pos, US);
+    std::memset(cuckoo_keys, 0, sizeof(cuckoo_keys));
+    for (Colour c = WHITE; c <= BLACK; ++c) {
+        for (Piece pc = KNIGHT; pc <= KING; ++pc) {
+            for (Square s1 = A1; s1 <= H8; ++s1) {
+                for (Square s2 = s1 + 1; s2 <= H8; ++s2) {
+                    if (!(pseudo_attacks(pc, s1) & (1ULL << s2))) continue;
+
+                    std::uint64_t key = piece_key(pc, s1, c) ^
+                                        piece_key(pc, s2, c) ^ side_key;
+                    Square squares[2] = {s1, s2};
+                    int i = cuckoo_h1(key);
+
+                    // Kick entries out to their other slot until one is free
+                    while (true) {
+                        std::swap(cuckoo_keys[i], key);
+                        std::swap(cuckoo_squares[i][0], squares[0]);
+                        std::swap(cuckoo_squares[i][1], squares[1]);
+                        if (!key) break;
+                        i = (i == cuckoo_h1(key)) ? cuckoo_h2(key)
+                                                  : cuckoo_h1(key);
+                    }
+                    count++;
+                }
+            }
+        }
+    }
+    assert(count == 3668);
+    (void)count;
+}
 
-    while (pieces) {
-        Square sq = lsb(pieces);
-        Piece pc = get_piece_on_square(pos, sq);
+/* Bump this whenever calculate_key() combines the keys differently */
+#define KEY_SCHEME_VERSION (3)
 
-        pos.hash_key ^= piece_sq_keys[pc][sq];
+/* Fingerprint the zobrist keys so saved hash tables can be matched to them */
+std::uint64_t key_fingerprint() {
+    std::uint64_t fingerprint = 0xCBF29CE484222325ULL;
+    auto mix = [&fingerprint](const std::uint64_t key) {
+        fingerprint = (fingerprint ^ key) * 0x100000001B3ULL;
+    };
 
-        pieces &= pieces - 1;
+    mix(KEY_SCHEME_VERSION);
+    for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 64; ++j) {
+            mix(piece_sq_keys[i][j]);
+        }
     }
+    for (int i = 0; i < 16; ++i) {
+        mix(castle_keys[i]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        mix(ep_keys[i]);
+    }
+    mix(side_key);
+
+    return fingerprint;
+}
+
+void calculate_key(Position &pos) {
+    pos.hash_key = 0;
+    pos.pawn_key = 0;
 
-    pieces = get_colour(pos, THEM);
+    for (Colour c = WHITE; c <= BLACK; ++c) {
+        std::uint64_t pieces = get_colour(pos, c);
 
-    while (pieces) {
-        Square sq = lsb(pieces);
-        Piece pc = get_piece_on_square(pos, sq);
+        while (pieces) {
+            Square sq = lsb(pieces);
+            Piece pc = get_piece_on_square(pos, sq);
 
-        pos.hash_key ^= bswap(piece_sq_keys[pc][sq]);
+            pos.hash_key ^= piece_key(pc, sq, c);
+            if (pc == PAWN) {
+                pos.pawn_key ^= piece_key(pc, sq, c);
+            }
 
-        pieces &= pieces - 1;
+            pieces &= pieces - 1;
+        }
     }
 
-    pos.hash_key ^= castle_keys[pos.castle];
+    pos.hash_key ^= castle_key(pos.castle);
 
     if (pos.epsq != INVALID_SQUARE) {
         pos.hash_key ^= ep_keys[pos.epsq & 7];
     }
 
-    if (pos.flipped) pos.hash_key ^= flip_key;
+    if (pos.side == BLACK) pos.hash_key ^= side_key;
+}
+
+/* Recalculate the material and PST scores and phases from the board. */
+void calculate_psq(Position &pos) {
+    for (Colour c = WHITE; c <= BLACK; ++c) {
+        std::uint64_t pieces = get_colour(pos, c);
+
+        pos.psq[c] = 0;
+        pos.phase[c] = 0;
+        while (pieces) {
+            Square sq = lsb(pieces);
+            Piece pc = get_piece_on_square(pos, sq);
+
+            pos.psq[c] += piece_sq_scores[c][pc][sq];
+            pos.phase[c] += phase_weights[pc];
+
+            pieces &= pieces - 1;
+        }
+    }
 }
 
 void parse_fen_to_position(const char *fen_str, Position &pos) {
@@ -110,60 +233,72 @@ void parse_fen_to_position(const char *fen_str, Position &pos) {
 
     std::memset((void *)&pos.pieces, 0, sizeof(pos.pieces));
     std::memset((void *)&pos.colours, 0, sizeof(pos.colours));
+    std::memset((void *)&pos.board, NO_PIECE, sizeof(pos.board));
+    std::memset((void *)&pos.psq, 0, sizeof(pos.psq));
+    std::memset((void *)&pos.phase, 0, sizeof(pos.phase));
 
     while (square_idx < ARR_LEN(fen_board)) {
         c = fen_str[i++];
 
         switch (c) {
             case 'p':
-                put_piece(pos, (const Square)fen_board[square_idx], PAWN, THEM);
+                put_piece(pos, (const Square)fen_board[square_idx], PAWN,
+                          BLACK);
                 square_idx++;
                 break;
             case 'r':
-                put_piece(pos, (const Square)fen_board[square_idx], ROOK, THEM);
+                put_piece(pos, (const Square)fen_board[square_idx], ROOK,
+                          BLACK);
                 square_idx++;
                 break;
             case 'n':
                 put_piece(pos, (const Square)fen_board[square_idx], KNIGHT,
-                          THEM);
+                          BLACK);
                 square_idx++;
                 break;
             case 'b':
                 put_piece(pos, (const Square)fen_board[square_idx], BISHOP,
-                          THEM);
+                          BLACK);
                 square_idx++;
                 break;
             case 'q':
                 put_piece(pos, (const Square)fen_board[square_idx], QUEEN,
-                          THEM);
+                          BLACK);
                 square_idx++;
                 break;
             case 'k':
-                put_piece(pos, (const Square)fen_board[square_idx], KING, THEM);
+                put_piece(pos, (const Square)fen_board[square_idx], KING,
+                          BLACK);
                 square_idx++;
                 break;
             case 'P':
-                put_piece(pos, (const Square)fen_board[square_idx], PAWN, US);
+                put_piece(pos, (const Square)fen_board[square_idx], PAWN,
+                          WHITE);
                 square_idx++;
                 break;
             case 'R':
-                put_piece(pos, (const Square)fen_board[square_idx], ROOK, US);
+                put_piece(pos, (const Square)fen_board[square_idx], ROOK,
+                          WHITE);
                 square_idx++;
                 break;
             case 'N':
-                put_piece(pos, (const Square)fen_board[square_idx], KNIGHT, US);
+                put_piece(pos, (const Square)fen_board[square_idx], KNIGHT,
+                          WHITE);
                 square_idx++;
                 break;
             case 'B':
-                put_piece(pos, (const Square)fen_board[square_idx], BISHOP, US);
+                put_piece(pos, (const Square)fen_board[square_idx], BISHOP,
+                          WHITE);
                 square_idx++;
                 break;
             case 'Q':
-                put_piece(pos, (const Square)fen_board[square_idx], QUEEN, US);
+                put_piece(pos, (const Square)fen_board[square_idx], QUEEN,
+                          WHITE);
                 square_idx++;
                 break;
             case 'K':
-                put_piece(pos, (const Square)fen_board[square_idx], KING, US);
+                put_piece(pos, (const Square)fen_board[square_idx], KING,
+                          WHITE);
                 square_idx++;
                 break;
             case '1':
@@ -180,7 +315,7 @@ void parse_fen_to_position(const char *fen_str, Position &pos) {
     }
 
     c = fen_str[++i];
-    bool flipped = c == 'b';
+    pos.side = c == 'b' ? BLACK : WHITE;
 
     i += 2;
     pos.castle = 0;
@@ -189,16 +324,16 @@ void parse_fen_to_position(const char *fen_str, Position &pos) {
 
         switch (c) {
             case 'K':
-                pos.castle |= US_OO;
+                pos.castle |= WHITE_OO;
                 break;
             case 'Q':
-                pos.castle |= US_OOO;
+                pos.castle |= WHITE_OOO;
                 break;
             case 'k':
-                pos.castle |= THEM_OO;
+                pos.castle |= BLACK_OO;
                 break;
             case 'q':
-                pos.castle |= THEM_OOO;
+                pos.castle |= BLACK_OOO;
                 break;
             case '-':
                 c = fen_str[i++];
@@ -225,14 +360,7 @@ void parse_fen_to_position(const char *fen_str, Position &pos) {
         pos.halfmoves = fen_str[i] - '0';
     }
 
-    pos.flipped = false;
-    if (flipped) flip_position(pos);
-
     calculate_key(pos);
-
-    pos.history.reserve(256);
-    pos.history.clear();
-    pos.history.push_back(pos.hash_key);
 }
 
 void print_position_struct(const Position &pos) {
@@ -245,18 +373,18 @@ void print_position_struct(const Position &pos) {
     }
 
     printf("Positions of our pieces:\n");
-    PRINT_BITBOARD(pos.colours[US]);
+    PRINT_BITBOARD(pos.colours[WHITE]);
 
     printf("Positions of their pieces:\n");
-    PRINT_BITBOARD(pos.colours[THEM]);
+    PRINT_BITBOARD(pos.colours[BLACK]);
 
-    // printf("Side to move is: %s\n\n", (pos.flipped == true) ? "THEM" : "US");
+    printf("Side to move is: %s\n\n", pos.side == WHITE ? "WHITE" : "BLACK");
 
-    if ((pos.castle & (1 << 3))) printf("White king can castle kingside\n");
-    if ((pos.castle & (1 << 2))) printf("White king can castle queenside\n");
+    if (pos.castle & WHITE_OO) printf("White king can castle kingside\n");
+    if (pos.castle & WHITE_OOO) printf("White king can castle queenside\n");
 
-    if ((pos.castle & (1 << 1))) printf("Black king can castle kingside\n");
-    if ((pos.castle & (1 << 0))) printf("Black king can castle queenside\n");
+    if (pos.castle & BLACK_OO) printf("Black king can castle kingside\n");
+    if (pos.castle & BLACK_OOO) printf("Black king can castle queenside\n");
 
     if (pos.epsq != INVALID_SQUARE)
         printf("\nEn passant square is: %u\n", (unsigned int)pos.epsq);
@@ -267,7 +395,6 @@ void print_position_struct(const Position &pos) {
 void run_fen_parser_tests() {
     Position tmp;
 
-    init_keys();
     parse_fen_to_position((const char*)"rnbqkbnr//pppppppp//8//8//8//8//PPPPPPPP//RNBQKBNR w KQkq - 0 1", tmp);
     print_position_struct(tmp);
     parse_fen_to_position((const char*)"rnbqkbnr//pppppppp//8///8//4P3//8//PPPP1PPP//RNBQKBNR b KQkq e3 0 1", tmp);
@@ -279,16 +406,10 @@ void run_fen_parser_tests() {
 }
 
 void print_position(const Position &pos) {
-    Position npos = pos;
-    if (pos.flipped) {
-        flip_position(npos);
-        calculate_key(npos);
-    }
-
     int sq = A8;
     while (sq >= 0) {
-        Piece piece = get_piece_on_square(npos, (std::uint64_t)1 << sq);
-        bool white = ((std::uint64_t)1 << sq) & get_colour(npos, US);
+        Piece piece = get_piece_on_square(pos, (Square)sq);
+        bool white = ((std::uint64_t)1 << sq) & get_colour(pos, WHITE);
 
         if (white)
             printf("%c", Piece_ASCII[piece]);
@@ -302,28 +423,82 @@ void print_position(const Position &pos) {
         sq++;
     }
 
-    printf("Flipped: %i\n", pos.flipped);
-    printf("Eval: %i\n", evaluate(npos));
+    printf("Side: %s\n", pos.side == WHITE ? "white" : "black");
+    printf("Eval: %i\n", evaluate(pos));
     printf("Hash: %" PRIx64 "\n", pos.hash_key);
     printf("Halfmoves: %i\n", pos.halfmoves);
-    printf("History: %" PRIu64 "\n", pos.history.size());
-    for (auto &i : pos.history) {
-        printf("  %" PRIx64 "\n", i);
+}
+
+/* Start a history at a position. */
+void history_reset(History &history, const Position &pos) {
+    history.keys[0] = pos.hash_key;
+    history.size = 1;
+    history.root = 0;
+}
+
+/* Add the position a move led to. */
+/* Positions before an irreversible move can't repeat, so they are dropped. */
+void history_push(History &history, const Position &pos) {
+    if (pos.halfmoves == 0) {
+        history.size = 0;
     }
+
+    assert(history.size < HISTORY_SIZE);
+    history.keys[history.size++] = pos.hash_key;
 }
 
-int repetitions(const Position &pos) {
+/* Count the earlier occurrences of the last position in the history. */
+int repetitions(const Position &pos, const History &history) {
+    assert(history.size > 0);
+    assert(history.keys[history.size - 1] == pos.hash_key);
+
     int count = 0;
-    for (int i = pos.history.size() - 3; i >= 0; --i) {
-        if (pos.history[i] == pos.history.back()) {
+    int last = history.size - 1;
+    int first = last - pos.halfmoves > 0 ? last - pos.halfmoves : 0;
+
+    // Only positions with the same side to move, at least two moves back,
+    // can be repeats.
+    for (int i = last - 4; i >= first; i -= 2) {
+        if (history.keys[i] == pos.hash_key) {
             count++;
         }
     }
     return count;
 }
 
-bool is_threefold(const Position &pos, const int depth_from_root) {
-    const int r = repetitions(pos);
+/* Can the side to move reach an earlier position of the search with one */
+/* move? The position is then a draw, at worst, a ply before it repeats. */
+bool upcoming_repetition(const Position &pos, const History &history,
+                         const int ply) {
+    assert(history.size > 0);
+    assert(history.keys[history.size - 1] == pos.hash_key);
+
+    const int last = history.size - 1;
+    const int end = pos.halfmoves < last ? pos.halfmoves : last;
+    const std::uint64_t occ = get_occupancy(pos);
+
+    // Positions an odd number of plies back have the other side to move,
+    // so a single move of ours can return to them.
+    for (int i = 3; i <= end && i < ply; i += 2) {
+        const std::uint64_t move_key = pos.hash_key ^ history.keys[last - i];
+
+        int j = cuckoo_h1(move_key);
+        if (cuckoo_keys[j] != move_key) {
+            j = cuckoo_h2(move_key);
+            if (cuckoo_keys[j] != move_key) continue;
+        }
+
+        if (!(between_mask[cuckoo_squares[j][0]][cuckoo_squares[j][1]] &
+              occ)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_threefold(const Position &pos, const History &history,
+                  const int depth_from_root) {
+    const int r = repetitions(pos, history);
     return r >= 2 || (r == 1 && depth_from_root > 2);
 }
 
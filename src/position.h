@@ -35,17 +35,36 @@ SOFTWARE.
 struct Position {
     std::uint64_t pieces[6];   // Bitboards containing piece locations.
     std::uint64_t colours[2];  // Bitboards containing colours of pieces.
+    Piece board[64];           // Piece on each square, or NO_PIECE.
+    Score psq[2];              // Material and PST score of each colour.
+    std::uint8_t phase[2];     // Material phase of each colour.
     std::uint8_t castle;       // Castling rights.
-    bool flipped;              // Has the board been flipped or not?
+    Colour side;               // Side to move.
     Square epsq;               // En passant square.
     std::uint8_t halfmoves;    // Fifty-move rule counter.
     std::uint64_t hash_key;    // Zobrist hash of the current position.
-    std::vector<std::uint64_t> history;  // Position history.
+    std::uint64_t pawn_key;    // Zobrist hash of the pawns alone.
+};
+
+/* Room for the keys since the last irreversible move, which the fifty-move */
+/* counter bounds, and for the keys of a search. */
+#define HISTORY_SIZE (256 + MAX_PLY)
+
+/* The keys of the positions leading to the current one, newest last. */
+struct History {
+    std::uint64_t keys[HISTORY_SIZE];
+    int size;
+    int root;  // Index of the root position while searching.
 };
 
 extern void print_position(const Position& pos);
-extern int repetitions(const Position& pos);
-extern bool is_threefold(const Position& pos, const int depth_from_root = 0);
+extern void history_reset(History& history, const Position& pos);
+extern void history_push(History& history, const Position& pos);
+extern int repetitions(const Position& pos, const History& history);
+extern bool upcoming_repetition(const Position& pos, const History& history,
+                                const int ply);
+extern bool is_threefold(const Position& pos, const History& history,
+                         const int depth_from_root = 0);
 extern bool is_fifty_moves(const Position& pos);
 
 /* Extract data from a FEN string to a Position struct */
@@ -68,9 +87,8 @@ inline Piece get_piece_on_square<KING>(const Position& pos,
 }
 
 /* Get the type of piece on a square */
-template <Piece piece = PAWN>
 inline Piece get_piece_on_square(const Position& pos, const Square sq) {
-    return get_piece_on_square<piece>(pos, (1ULL << sq));
+    return pos.board[sq];
 }
 
 /* Get a piece bitboard. */
@@ -84,7 +102,7 @@ inline std::uint64_t get_colour(const Position& b, const Colour c) {
 }
 
 inline std::uint64_t get_occupancy(const Position& pos) {
-    return pos.colours[US] | pos.colours[THEM];
+    return pos.colours[WHITE] | pos.colours[BLACK];
 }
 
 /* Get a piece bitboard of a colour. */
@@ -113,13 +131,24 @@ inline void clear_bit(Position& b, const Colour c, const Square sq) {
     b.colours[c] &= ~(1ULL << sq);
 }
 
+/* Material and PST score of a piece on a square, seen from its colour. */
+extern Score piece_sq_scores[2][6][64];
+
+/* Phase weights for material. */
+extern const int phase_weights[7];
+
 /* Updates the position by moving piece from 'from' to 'to' */
 inline void move_piece(Position& pos, const Square from, const Square to,
                        const Piece piece, const Colour colour) {
     assert(from != to);
+    assert(pos.board[from] == piece);
     std::uint64_t from_to = (1ULL << from) ^ (1ULL << to);
     pos.pieces[piece] ^= from_to;
     pos.colours[colour] ^= from_to;
+    pos.board[from] = NO_PIECE;
+    pos.board[to] = piece;
+    pos.psq[colour] += piece_sq_scores[colour][piece][to] -
+                       piece_sq_scores[colour][piece][from];
 }
 
 /* Updates the position by putting piece on 'to' */
@@ -128,14 +157,21 @@ inline void put_piece(Position& pos, const Square to, const Piece piece,
     std::uint64_t to_bit = (1ULL << to);
     pos.pieces[piece] |= to_bit;
     pos.colours[colour] |= to_bit;
+    pos.board[to] = piece;
+    pos.psq[colour] += piece_sq_scores[colour][piece][to];
+    pos.phase[colour] += phase_weights[piece];
 }
 
 /* Updates the position by removing piece from 'from' */
 inline void remove_piece(Position& pos, const Square from, const Piece piece,
                          const Colour colour) {
+    assert(pos.board[from] == piece);
     std::uint64_t from_bit = (1ULL << from);
     pos.pieces[piece] ^= from_bit;
     pos.colours[colour] ^= from_bit;
+    pos.board[from] = NO_PIECE;
+    pos.psq[colour] -= piece_sq_scores[colour][piece][from];
+    pos.phase[colour] -= phase_weights[piece];
 }
 
 /* Get any piece attacks to a square. */
@@ -163,43 +199,36 @@ inline std::uint64_t attacks_to<KING>(const Position& pos, const Square sq,
 
 /* Checks to see if c is in check */
 inline bool is_checked(const Position& pos, const Colour c) {
-    Colour by = (c == US ? THEM : US);
     return (attacks_to(pos, lsb(get_piece(pos, KING, c)), get_occupancy(pos),
                        c) &
-            get_colour(pos, by)) > std::uint64_t(0);
+            get_colour(pos, ~c)) > std::uint64_t(0);
 }
 
-/* Flips the position */
-inline void flip_position(Position& pos) {
-    // Flip piece bitboards
-    std::uint64_t* curr;
-    for (curr = pos.pieces; curr < pos.pieces + 6; ++curr) *curr = bswap(*curr);
-
-    // Reverse colour bitboards
-    std::uint64_t tmp = pos.colours[1];
-    pos.colours[1] = pos.colours[0];
-    pos.colours[0] = tmp;
-
-    // Flip colour bitboards
-    for (curr = pos.colours; curr < pos.colours + 2; ++curr)
-        *curr = bswap(*curr);
+/* The zobrist keys used to hash the position, generated at compile time */
+extern const Table<Table<std::uint64_t, 64>, 6> piece_sq_keys;
+extern const Table<std::uint64_t, 16> castle_keys;
+extern const Table<std::uint64_t, 8> ep_keys;
+extern const std::uint64_t side_key;
 
-    // Flip epsq
-    if (pos.epsq != INVALID_SQUARE) pos.epsq = Square(int(pos.epsq) ^ 56);
-
-    // Flip castling rights
-    std::uint8_t tmp2 = (pos.castle & 3) << 2;
-    pos.castle >>= 2;
-    pos.castle ^= tmp2;
+/* Get the zobrist key of a piece on a square. */
+/* Black pieces use the byte-swapped key of the white piece. */
+inline std::uint64_t piece_key(const Piece piece, const Square sq,
+                               const Colour colour) {
+    std::uint64_t key = piece_sq_keys[piece][sq];
+    return colour == WHITE ? key : bswap(key);
+}
 
-    // Flip flipped
-    pos.flipped = !pos.flipped;
+/* Get the zobrist key of a set of castling rights. */
+inline std::uint64_t castle_key(const std::uint8_t castle) {
+    return castle_keys[castle];
 }
 
-extern std::uint64_t perft(const Position& pos, int depth);
-extern std::uint64_t perft_tt(TT* tt, const Position& pos, int depth);
-extern void run_perft_tests();
+extern std::uint64_t perft_tt(PerftTT* tt, const Position& pos, int depth);
+extern std::uint64_t perft_parallel(PerftTT* tt, const Position& pos,
+                                    int depth, int threads, int split);
 
-extern void init_keys();
+extern void init_cuckoo();
 extern void calculate_key(Position& pos);
+extern void calculate_psq(Position& pos);
+extern std::uint64_t key_fingerprint();
 #endif
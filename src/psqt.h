@@ -24,13 +24,23 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+/* Piece values for material in centipawns. */
+const int piecevals[2][7] = {{100, 300, 300, 500, 900, 0, 0},
+                             {100, 300, 300, 500, 900, 0, 0}};
+
+/* Mobility weights for material. */
+const int mobility_weights[7] = {0, 4, 4, 4, 4, 0, 0};
+
+/* Passed pawn advancement bonus. */
+const int passed_pawn_bonus[8] = {0, 0, 10, 20, 40, 80, 160, 0};
+
 /* PST values in centipawns. */
 const int pst[6][2][64] = {
     { // Pawns
         { // Middlegame
           0,   0,   0,   0,   0,   0,   0,   0,
          -1,  -7, -11, -35, -13,   5,   3,  -5,
-          1,  1,   -6, -19,  -6,  -7,  -4,  10,
+          1,   1,  -6, -19,  -6,  -7,  -4,  10,
           1,  14,   8,   4,   5,   4,  10,   7,
           9,  30,  23,  31,  31,  23,  17,  11,
          21,  54,  72,  56,  77,  95,  71,  11,
@@ -49,7 +59,7 @@ const int pst[6][2][64] = {
         }
     },
     { // Knights
-        {
+        { // Middlegame
         -99, -30, -66, -64, -29, -19, -61, -81,
         -56, -31, -28,  -1,  -7, -20, -42, -11,
         -38, -16,   0,  14,   8,   3,   3, -42,
@@ -59,7 +69,7 @@ const int pst[6][2][64] = {
         -34,  24,  54,  74,  60, 122,   2,  29,
         -60,   0,   0,   0,   0,   0,   0,   0
         },
-        {
+        { // Endgame
         -99, -99, -94, -88, -88, -94, -99, -99,
         -81, -62, -49, -43, -43, -49, -62, -81,
         -46, -27, -15,  -9,  -9, -15, -27, -46,
@@ -71,7 +81,7 @@ const int pst[6][2][64] = {
         }
     },
     { // Bishops
-        {
+        { // Middlegame
          -7,  12,  -8, -37, -31,  -8, -45, -67,
          15,   5,  13, -10,   1,   2,   0,  15,
           5,  12,  14,  13,  10,  -1,   3,   4,
@@ -81,7 +91,7 @@ const int pst[6][2][64] = {
         -24, -23,  30,  58,  65,  61,  69,  11,
           0,   0,   0,   0,   0,   0,   0,   0
         },
-        {
+        { // Endgame
         -27, -21, -17, -15, -15, -17, -21, -27,
         -10,  -4,   0,   2,   2,   0,  -4, -10,
           2,   8,  12,  14,  14,  12,   8,   2,
@@ -93,7 +103,7 @@ const int pst[6][2][64] = {
         }
     },
     { // Rooks
-        {
+        { // Middlegame
          -2,  -1,   3,   1,   2,   1,   4,  -8,
         -26,  -6,   2,  -2,   2, -10,  -1, -29,
         -16,   0,   3,  -3,   8,  -1,  12,   3,
@@ -102,9 +112,8 @@ const int pst[6][2][64] = {
          24,  83,  54,  75, 134, 144,  85,  75,
          46,  33,  64,  62,  91,  89,  70, 104,
          84,   0,   0,  37, 124,   0,   0, 153
-
         },
-        {
+        { // Endgame
         -32, -31, -30, -29, -29, -30, -31, -32,
         -27, -25, -24, -24, -24, -24, -25, -27,
         -15, -13, -12, -12, -12, -12, -13, -15,
@@ -115,8 +124,8 @@ const int pst[6][2][64] = {
          16,  17,  18,  19,  19,  18,  17,  16
         }
     },
-    { // Queen
-        {
+    { // Queens
+        { // Middlegame
           1, -10, -11,   3, -15, -51, -83, -13,
          -7,   3,   2,   5,  -1, -10,  -7,  -2,
         -11,   0,  12,   2,   8,  11,   7,  -6,
@@ -126,7 +135,7 @@ const int pst[6][2][64] = {
           1,  11,  35,   0,  16,  55,  39,  57,
         -13,   6, -42,   0,  29,   0,   0, 102
         },
-        {
+        { // Endgame
         -61, -55, -52, -50, -50, -52, -55, -61,
         -31, -26, -22, -21, -21, -22, -26, -31,
          -8,  -3,   1,   3,   3,   1,  -3,  -8,
@@ -138,7 +147,7 @@ const int pst[6][2][64] = {
         }
     },
     { // King
-        {
+        { // Middlegame
           0,   0,   0,  -9,   0,  -9,  25,   0,
          -9,  -9,  -9,  -9,  -9,  -9,  -9,  -9,
          -9,  -9,  -9,  -9,  -9,  -9,  -9,  -9,
@@ -148,7 +157,7 @@ const int pst[6][2][64] = {
          -9,  -9,  -9,  -9,  -9,  -9,  -9,  -9,
          -9,  -9,  -9,  -9,  -9,  -9,  -9,  -9
         },
-        {
+        { // Endgame
         -34, -30, -28, -27, -27, -28, -30, -34,
         -17, -13, -11, -10, -10, -11, -13, -17,
          -2,   2,   4,   5,   5,   4,   2,  -2,
@@ -159,4 +168,4 @@ const int pst[6][2][64] = {
          42,  46,  48,  50,  50,  48,  46,  42
         }
     }
-};
\ No newline at end of file
+};
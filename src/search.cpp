@@ -27,6 +27,7 @@ SOFTWARE.
 #include <cassert>
 #include <chrono>
 #include <cinttypes>
+#include <cstdio>
 #include <vector>
 
 #include "eval.h"
@@ -99,25 +100,102 @@ Move next_move(SearchStack* ss, int& size) {
     return best_move;
 }
 
+/* Is a transposition table move one of a node's legal moves? */
+inline bool is_hash_move(const Position& pos, const Move* moves,
+                         const int movecount, const Move move) {
+    for (int i = 0; i < movecount; ++i) {
+        if (moves[i] == move) {
+            return is_legal(pos, move);
+        }
+    }
+    return false;
+}
+
+/* Has the search used up its time or nodes? */
+inline bool should_stop(SearchController& sc, const SearchStack* ss) {
+    if (!sc.stopped &&
+        ((sc.max_nodes && ss->stats->node_count >= sc.max_nodes) ||
+         (!sc.infinite && now() >= sc.search_end_time))) {
+        sc.stopped = true;
+    }
+    return sc.stopped;
+}
+
+/* Get the static eval of a node, evaluating it only if the eval table */
+/* doesn't have it. */
+inline int static_eval(SearchController& sc, const Position& pos,
+                       SearchStack* ss) {
+    int eval;
+    if (!eval_table_probe(sc.evals, pos, eval)) {
+#ifdef TESTING
+        ++ss->stats->evaluations;
+#endif
+        eval =
+            use_nnue ? nnue_evaluate(pos, ss->acc) : evaluate(pos, sc.pawns);
+        eval_table_store(sc.evals, pos, eval);
+    }
+
+    return eval;
+}
+
+/* Get the static eval of a node for comparing with a window. Far enough */
+/* outside the window it may only be a bound, so it isn't kept. */
+inline int static_eval(SearchController& sc, const Position& pos,
+                       const int alpha, const int beta, SearchStack* ss) {
+    int eval;
+    if (use_nnue) {
+        return static_eval(sc, pos, ss);
+    } else if (eval_table_probe(sc.evals, pos, eval)) {
+        return eval;
+    }
+
+#ifdef TESTING
+    ++ss->stats->evaluations;
+#endif
+    bool exact;
+    eval = evaluate(pos, sc.pawns, alpha, beta, exact);
+    if (exact) {
+        eval_table_store(sc.evals, pos, eval);
+    }
+
+    return eval;
+}
+
+/* Bring the network's accumulator of a node up to date, from its parent's */
+/* and the pieces the move to it changed below the root. */
+inline void update_accumulator(const Position& pos, SearchStack* ss) {
+    if (!use_nnue) {
+        return;
+    }
+
+    if (ss->ply) {
+        nnue_update(pos, ss->dirty, (ss - 1)->acc, ss->acc);
+    } else {
+        nnue_refresh(pos, ss->acc);
+    }
+}
+
 /* Quiescence alpha-beta search a search leaf node to reduce the horizon effect.
  */
+template <typename Strategy = MoveStrategy>
 int quiesce(SearchController& sc, Position& pos, int alpha, int beta,
             SearchStack* ss) {
     assert(ss);
 
+    update_accumulator(pos, ss);
+
     if (ss->ply >= MAX_PLY) {
-        return evaluate(pos);
+        return static_eval(sc, pos, ss);
     }
 
     // Check time left
-    clock_t current_time = clock() * 1000 / CLOCKS_PER_SEC;
-    if (current_time >= sc.search_end_time) {
+    if (should_stop(sc, ss)) {
         return 0;
     }
 
     int movecount, value;
 
-    value = evaluate(pos);
+    value = static_eval(sc, pos, alpha, beta, ss);
     if (value >= beta) return beta;
 
     if (value > alpha) alpha = value;
@@ -129,15 +207,19 @@ int quiesce(SearchController& sc, Position& pos, int alpha, int beta,
     score_moves(pos, ss, movecount, 0);
 
     Move move;
+    typename Strategy::State state;
     while ((move = next_move(ss, movecount))) {
-        Position npos = pos;
-
-        make_move(npos, move);
-        if (is_checked(npos, THEM)) {
+        if (use_nnue) {
+            nnue_dirty(pos, move, (ss + 1)->dirty);
+        }
+        Position& npos = Strategy::make(pos, move, state);
+        if (is_checked(npos, ~npos.side)) {
+            Strategy::unmake(pos, move, state);
             continue;
         }
 
-        value = -quiesce(sc, npos, -beta, -alpha, ss + 1);
+        value = -quiesce<Strategy>(sc, npos, -beta, -alpha, ss + 1);
+        Strategy::unmake(pos, move, state);
 
         if (value >= beta) {
             return beta;
@@ -151,50 +233,72 @@ int quiesce(SearchController& sc, Position& pos, int alpha, int beta,
 }
 
 /* Alpha-Beta search a position to return a score. */
-template <bool pv_node = true>
+template <bool pv_node = true, typename Strategy = MoveStrategy>
 int search(SearchController& sc, Position& pos, int depth, int alpha, int beta,
            SearchStack* ss, PV& pv) {
     assert(ss);
 
-    if (is_fifty_moves(pos) || is_threefold(pos, ss->ply)) {
+    // Record the position in the ply-indexed part of the history
+    History& history = *ss->history;
+    history.size = history.root + ss->ply + 1;
+    history.keys[history.size - 1] = pos.hash_key;
+
+    if (is_fifty_moves(pos) || is_threefold(pos, history, ss->ply)) {
         return 0;
     }
 
-    const bool in_check = is_checked(pos, US);
+    // A move back to an earlier position of the search draws at worst
+    if (alpha < 0 && upcoming_repetition(pos, history, ss->ply)) {
+        alpha = 0;
+        if (alpha >= beta) {
+            return alpha;
+        }
+    }
+
+    const bool in_check = is_checked(pos, pos.side);
 
     // Check extensions
     if (in_check) depth++;
 
     if (depth <= 0) {
-        return quiesce(sc, pos, alpha, beta, ss);
+        return quiesce<Strategy>(sc, pos, alpha, beta, ss);
     }
 
+    update_accumulator(pos, ss);
+
     if (ss->ply >= MAX_PLY) {
-        return evaluate(pos);
+        return static_eval(sc, pos, ss);
     }
 
     // Check time left
-    clock_t current_time = clock() * 1000 / CLOCKS_PER_SEC;
-    if (ss->ply && current_time >= sc.search_end_time) {
+    if (ss->ply && should_stop(sc, ss)) {
         return 0;
     }
 
     // Update info
-    if (ss->stats->node_count % 1048576 == 0) {
+    if (!sc.silent && ss->stats->node_count % 1048576 == 0) {
+        const std::int64_t current_time = now();
         if (current_time > sc.search_start_time) {
             printf("info nps %" PRIu64 "\n",
                    1000 * (ss->stats->node_count) /
-                       (current_time - sc.search_start_time));
+                       std::uint64_t(current_time - sc.search_start_time));
         }
     }
 
     ++ss->stats->node_count;
 
+    int movecount, value;
+    movecount = generate(pos, ss->ml);
+
     // Check transposition table
     Move hash_move = 0;
-    TTEntry entry = tt_poll(&sc.tt, pos.hash_key);
+    TTEntry entry = tt_poll(sc.tt, pos.hash_key);
 
-    if (entry.hash_key == pos.hash_key) {
+    // Entries only keep 16 bits of the key, so one stored for another
+    // position can match. Its move is then unlikely to be legal here, and
+    // the entry is ignored rather than cutting off with it.
+    if (entry.data &&
+        is_hash_move(pos, ss->ml, movecount, tt_move(entry.data))) {
         int entry_depth = tt_depth(entry.data);
         hash_move = tt_move(entry.data);
 
@@ -211,9 +315,6 @@ int search(SearchController& sc, Position& pos, int depth, int alpha, int beta,
         }
     }
 
-    int movecount, value;
-    movecount = generate(pos, ss->ml);
-
     score_moves(pos, ss, movecount, hash_move);
 
     int legal_moves = 0;
@@ -223,23 +324,31 @@ int search(SearchController& sc, Position& pos, int depth, int alpha, int beta,
     Move move;
     Move best_move = 0;
     PV child_pv;
+    typename Strategy::State state;
     while ((move = next_move(ss, movecount))) {
-        child_pv.clear();
-        Position npos = pos;
+        if (depth > 1) {
+            tt_prefetch(sc.tt, key_after(pos, move));
+        }
 
-        make_move(npos, move);
-        if (is_checked(npos, THEM)) {
+        child_pv.clear();
+        if (use_nnue) {
+            nnue_dirty(pos, move, (ss + 1)->dirty);
+        }
+        Position& npos = Strategy::make(pos, move, state);
+        if (is_checked(npos, ~npos.side)) {
+            Strategy::unmake(pos, move, state);
             continue;
         }
 
         ++legal_moves;
 
         if (legal_moves == 1)
-            value =
-                -search(sc, npos, depth - 1, -beta, -alpha, ss + 1, child_pv);
+            value = -search<true, Strategy>(sc, npos, depth - 1, -beta,
+                                            -alpha, ss + 1, child_pv);
         else
-            value = -search<false>(sc, npos, depth - 1, -beta, -alpha, ss + 1,
-                                   child_pv);
+            value = -search<false, Strategy>(sc, npos, depth - 1, -beta,
+                                             -alpha, ss + 1, child_pv);
+        Strategy::unmake(pos, move, state);
 
         if (value > best_value) {
             best_value = value;
@@ -264,7 +373,7 @@ int search(SearchController& sc, Position& pos, int depth, int alpha, int beta,
                 ss->killers[1] = ss->killers[0];
                 ss->killers[0] = move;
             }
-            tt_add(&sc.tt, pos.hash_key, move, depth, TT_LOWER,
+            tt_add(sc.tt, pos.hash_key, move, depth, TT_LOWER,
                    eval_to_tt(value, ss->ply));
             return beta;
         }
@@ -279,7 +388,7 @@ int search(SearchController& sc, Position& pos, int depth, int alpha, int beta,
 
     // Add entry to transposition table
     int flag = alpha == old_alpha ? TT_UPPER : TT_EXACT;
-    tt_add(&sc.tt, pos.hash_key, best_move, depth, flag,
+    tt_add(sc.tt, pos.hash_key, best_move, depth, flag,
            eval_to_tt(best_value, ss->ply));
 
 #ifdef TESTING
@@ -287,6 +396,8 @@ int search(SearchController& sc, Position& pos, int depth, int alpha, int beta,
         printf(
             "info string ordering = %lf\n",
             double(ss->stats->first_move_fail_highs) / ss->stats->fail_highs);
+        printf("info string evaluations per node = %lf\n",
+               double(ss->stats->evaluations) / ss->stats->node_count);
     }
 #endif
 
@@ -299,6 +410,7 @@ void clear_stats(Stats& stats) {
 #ifdef TESTING
     stats.fail_highs = 0;
     stats.first_move_fail_highs = 0;
+    stats.evaluations = 0;
 #endif
 }
 
@@ -317,27 +429,42 @@ void clear_ss(SearchStack* ss, int size) {
 void set_stats(SearchStack* ss, Stats& stats) {
     assert(ss);
 
-    SearchStack* end = ss - ss->ply + MAX_PLY;
+    SearchStack* end = ss - ss->ply + SEARCH_STACK_SIZE;
     for (; ss < end; ++ss) {
         ss->stats = &stats;
     }
 }
 
+/* Set the History pointer for all ply after 'ss' */
+void set_history(SearchStack* ss, History& history) {
+    assert(ss);
+
+    SearchStack* end = ss - ss->ply + SEARCH_STACK_SIZE;
+    for (; ss < end; ++ss) {
+        ss->history = &history;
+    }
+}
+
 #define GUESSED_LENGTH 40
 
-/* Start searching a position */
-void start_search(SearchController& sc) {
+/* Search the controller's position by iterative deepening. */
+/* The caller clears sc.stopped, so a stop can come before the search starts. */
+void search_position(SearchController& sc, SearchResult& result) {
     Stats stats;
-    SearchStack ss[MAX_PLY];
-    std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+    History history = sc.history;
+    SearchStack ss[SEARCH_STACK_SIZE];
 
     clear_stats(stats);
-    clear_ss(ss, MAX_PLY);
+    clear_ss(ss, SEARCH_STACK_SIZE);
 
     set_stats(ss, stats);
 
+    // The search's keys go after the game's.
+    history.root = history.size - 1;
+    set_history(ss, history);
+
     /* Timing */
-    sc.search_start_time = 1000 * clock() / CLOCKS_PER_SEC;
+    sc.search_start_time = now();
 
     if (sc.movetime) {
         sc.search_end_time = sc.movetime / 2;
@@ -354,9 +481,10 @@ void start_search(SearchController& sc) {
     sc.search_end_time += sc.search_start_time;
 
     char mstr[6];
-    Move best_move;
-    int best_score = -INF;
-    PV pv;
+
+    result.score = -INF;
+    result.depth = 0;
+    result.pv.clear();
 
     /* Iterative deepening */
     for (std::uint32_t depth = 1; depth < sc.max_depth; ++depth) {
@@ -368,23 +496,26 @@ void start_search(SearchController& sc) {
             search(sc, sc.pos, depth, alpha, beta, ss, depth_pv);
 
         // Check time used
-        clock_t time_used =
-            clock() * 1000 / CLOCKS_PER_SEC - sc.search_start_time;
+        std::int64_t time_used = now() - sc.search_start_time;
 
-        // See if we ran out of time
-        if (depth > 1 &&
-            time_used >= sc.search_end_time - sc.search_start_time) {
+        // See if we ran out of time or nodes
+        if (depth > 1 && sc.stopped) {
             break;
         }
 
         // Only update the best pv if we didn't run out of time
-        pv = depth_pv;
+        result.pv = depth_pv;
+        result.depth = depth;
 
         // Verify the pv is legal
-        assert(pv_verify(sc.pos, pv));
-        assert(pv.size() > 0);
+        assert(pv_verify(sc.pos, result.pv));
 
-        best_score = depth_best_score;
+        int best_score = result.score = depth_best_score;
+
+        // No legal moves, so the score is final
+        if (result.pv.empty()) {
+            break;
+        }
 
         bool mate = false;
         if (best_score > INF - MAX_PLY) {
@@ -397,36 +528,42 @@ void start_search(SearchController& sc) {
         }
 
         // Update info
-        if (mate) {
-            printf("info score mate %i depth %i nodes %" PRIu64 " time %lu pv ",
-                   best_score, depth, stats.node_count, time_used);
-        } else {
-            printf("info score cp %i depth %i nodes %" PRIu64 " time %lu pv ",
-                   best_score, depth, stats.node_count, time_used);
-        }
-        bool flipped = sc.pos.flipped;
-        for (Move move : pv) {
-            if (flipped) {
-                move = flip_move(move);
+        if (!sc.silent) {
+            if (mate) {
+                printf("info score mate %i depth %i nodes %" PRIu64
+                       " time %" PRId64 " pv ",
+                       best_score, depth, stats.node_count, time_used);
+            } else {
+                printf("info score cp %i depth %i nodes %" PRIu64
+                       " time %" PRId64 " pv ",
+                       best_score, depth, stats.node_count, time_used);
+            }
+            for (Move move : result.pv) {
+                move_to_lan(mstr, move);
+                printf("%s ", mstr);
             }
-            move_to_lan(mstr, move);
-            printf("%s ", mstr);
-            flipped ^= 1;
+            printf("\n");
         }
-        printf("\n");
 
-        // Exit if mate found
-        if (mate) {
+        // Exit if mate found, or if the time is used up anyway
+        if (mate || sc.stopped) {
             break;
         }
     }
 
-    if (pv.size() >= 1) {
-        best_move = pv[0];
-        if (sc.pos.flipped) {
-            best_move = flip_move(best_move);
-        }
-        move_to_lan(mstr, best_move);
+    result.nodes = stats.node_count;
+}
+
+/* Start searching a position */
+void start_search(SearchController& sc) {
+    SearchResult result;
+    char mstr[6];
+
+    tt_new_search(sc.tt);
+    search_position(sc, result);
+
+    if (result.pv.size() >= 1) {
+        move_to_lan(mstr, result.pv[0]);
 
         printf("bestmove %s\n", mstr);
     } else {
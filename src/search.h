@@ -27,8 +27,12 @@ SOFTWARE.
 #ifndef SEARCH_H
 #define SEARCH_H
 
-#include <ctime>  // clock_t, clock()
+#include <atomic>
+
+#include "eval.h"
+#include "misc.h"
 #include "move.h"
+#include "nnue.h"
 #include "position.h"
 #include "tt.h"
 
@@ -38,30 +42,55 @@ struct Stats {
 #ifdef TESTING
     std::uint64_t fail_highs;
     std::uint64_t first_move_fail_highs;
+    std::uint64_t evaluations;  // Static evals not found in the eval table.
 #endif
 };
 
+/* Plies of a search stack. The nodes at MAX_PLY only return their static */
+/* eval, but are written to like any other. */
+#define SEARCH_STACK_SIZE (MAX_PLY + 1)
+
 /* A data structure to pass local parameters thru */
 struct SearchStack {
     std::uint8_t ply;
     Move ml[256];
     int score[256];
     Move killers[2];
+    Accumulator acc;  // First layer of the network, if one is loaded.
+    DirtyPieces dirty;  // Pieces the move to this node changed, if so.
     Stats* stats;
+    History* history;
 };
 
+/* Times are in milliseconds of now(). */
 struct SearchController {
     Position pos;
+    History history;  // Keys of the game leading to pos.
     std::uint32_t max_depth;
     std::uint32_t moves_per_session;
-    clock_t increment;
-    clock_t search_start_time;
-    clock_t search_end_time;
-    clock_t our_clock;
-    clock_t movetime;
-    TT tt;
+    std::uint64_t max_nodes;  // Node limit, or 0 for none.
+    std::int64_t increment;
+    std::int64_t search_start_time;
+    std::int64_t search_end_time;
+    std::int64_t our_clock;
+    std::int64_t movetime;
+    bool infinite;  // Ignore the clock, and stop on depth or nodes.
+    bool silent;    // Don't print info lines.
+    std::atomic<bool> stopped;  // Out of time or nodes, or told to stop.
+    TT* tt;
+    PawnTable pawns;  // This thread's pawn structure evaluations.
+    EvalTable evals;  // This thread's static evals.
+};
+
+/* The outcome of a search. */
+struct SearchResult {
+    int score;
+    std::uint32_t depth;  // Depth of the last completed iteration.
+    std::uint64_t nodes;
+    PV pv;  // Empty if there was no legal move.
 };
 
+extern void search_position(SearchController& sc, SearchResult& result);
 extern void start_search(SearchController& sc);
 extern void clear_ss(SearchStack* ss, int size);
 extern Move next_move(SearchStack* ss, int& size);
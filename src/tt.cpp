@@ -27,30 +27,181 @@
 
 #include "tt.h"
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Allocations are rounded up to this so they can be backed by huge pages */
+#define TT_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Tables smaller than this are cleared without starting threads */
+#define TT_PARALLEL_CLEAR_SIZE (64 * 1024 * 1024)
+
+/* Allocate zeroed, cache line aligned memory, using huge pages if we can. */
+/* What has to be released afterwards is stored in memory or mapping. */
+static void* tt_allocate(const std::size_t bytes, void*& memory, void*& mapping,
+                         std::size_t& mapping_size) {
+    memory = nullptr;
+    mapping = nullptr;
+    mapping_size = 0;
+
+#if !defined(_WIN32)
+    const std::size_t rounded = (bytes + TT_HUGE_PAGE_SIZE - 1) &
+                                ~(std::size_t)(TT_HUGE_PAGE_SIZE - 1);
+    void* map = MAP_FAILED;
+
+    // Prefer explicit huge pages, which only exist if the admin reserved them.
+#if defined(MAP_HUGETLB)
+    map = mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    // Otherwise ask for transparent huge pages.
+    if (map == MAP_FAILED) {
+        map = mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if defined(MADV_HUGEPAGE)
+        if (map != MAP_FAILED) {
+            madvise(map, rounded, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    if (map != MAP_FAILED) {
+        mapping = map;
+        mapping_size = rounded;
+        return map;
+    }
+#endif
+
+    // Over-allocate so the buckets can be aligned to cache lines.
+    memory = calloc(1, bytes + 64);
+    if (!memory) {
+        return nullptr;
+    }
+
+    return (void*)(((std::uintptr_t)memory + 63) & ~(std::uintptr_t)63);
+}
 
-bool tt_create(TT* tt, const std::uint32_t megabytes) {
+/* Release memory returned by tt_allocate(). */
+static void tt_deallocate(void*& memory, void*& mapping,
+                          std::size_t& mapping_size) {
+#if !defined(_WIN32)
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+#endif
+    free(memory);
+    memory = nullptr;
+    mapping = nullptr;
+    mapping_size = 0;
+}
+
+/* Run a job over the buckets of a table, splitting large tables into */
+/* ranges handled by separate threads. */
+template <typename Job>
+static void tt_parallel(const std::size_t buckets, const Job& job) {
+    unsigned int num_threads = std::thread::hardware_concurrency();
+
+    if (buckets * 64 < TT_PARALLEL_CLEAR_SIZE || num_threads <= 1) {
+        job(0, buckets);
+        return;
+    }
+
+    // Give each thread its own range, so that on NUMA machines the pages also
+    // end up spread over the nodes.
+    std::vector<std::thread> threads;
+    const std::size_t slice = (buckets + num_threads - 1) / num_threads;
+    for (std::size_t start = 0; start < buckets; start += slice) {
+        const std::size_t end = buckets - start < slice ? buckets : start + slice;
+        threads.emplace_back([&job, start, end]() { job(start, end); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+/* Wipe the entries left over from previous games. */
+static void tt_clear_stale(TT* tt) {
+    tt_parallel(tt->size, [tt](const std::size_t start, const std::size_t end) {
+        for (std::size_t i = start; i < end; ++i) {
+            for (int j = 0; j < TT_BUCKET_SIZE; ++j) {
+                TTEntry& entry = tt->data[i].entries[j];
+                if (entry.data && !tt_live(tt, entry.data)) {
+                    entry.data = 0;
+                }
+            }
+        }
+    });
+}
+
+bool tt_create(TT* tt, const std::uint64_t megabytes) {
     assert(tt);
 
     if (megabytes <= 0) {
         return false;
-    } else if (megabytes > 512) {
+    } else if (megabytes > SIZE_MAX / (1024 * 1024)) {
         return false;
     }
 
-    int num_entries = 1024 * 1024 * megabytes / sizeof(TTEntry);
+    const std::size_t num_buckets = 1024 * 1024 * megabytes / sizeof(TTBucket);
+
+    assert(num_buckets * sizeof(TTBucket) <= 1024 * 1024 * megabytes);
+
+    tt->generation = 0;
+    tt->game_generation = 1;
+    tt->data = (TTBucket*)tt_allocate(num_buckets * sizeof(TTBucket),
+                                      tt->memory, tt->mapping,
+                                      tt->mapping_size);
+    tt->size = tt->data ? num_buckets : 0;
+
+    return tt->data != nullptr;
+}
 
-    assert(num_entries * sizeof(TTEntry) <= 1024 * 1024 * megabytes);
+void tt_new_search(TT* tt) {
+    assert(tt);
 
-    tt->data = (TTEntry*)malloc(num_entries * sizeof(TTEntry));
+    tt->generation = (tt->generation + 1) & TT_GEN_MASK;
 
-    if (tt->data) {
-        tt->size = num_entries;
-        return true;
+    // Keep the window of live generations from wrapping around.
+    if (tt->generation == tt->game_generation) {
+        tt->game_generation = (tt->game_generation + 1) & TT_GEN_MASK;
     }
+}
 
-    tt->size = 0;
-    return false;
+void tt_new_game(TT* tt) {
+    assert(tt);
+
+    tt_wait(tt);
+
+    if (!tt->data) {
+        return;
+    }
+
+    // Everything before the new generation is now stale. Clearing only frees
+    // up the slots, so it is left to a thread rather than making the GUI wait;
+    // it must be waited for before the next search.
+    tt->generation = (tt->generation + 1) & TT_GEN_MASK;
+    tt->game_generation = tt->generation;
+    tt->cleaner = std::thread(tt_clear_stale, tt);
+}
+
+void tt_wait(TT* tt) {
+    assert(tt);
+
+    if (tt->cleaner.joinable()) {
+        tt->cleaner.join();
+    }
 }
 
 TTEntry tt_poll(TT* tt, const std::uint64_t key) {
@@ -58,82 +209,326 @@ TTEntry tt_poll(TT* tt, const std::uint64_t key) {
     assert(tt->size);
     assert(tt->data);
 
-    int index = key % tt->size;
+    std::size_t index = tt_index(tt, key);
 
     assert(index < tt->size);
 
-    return tt->data[index];
+    const TTBucket& bucket = tt->data[index];
+    const std::uint64_t check = tt_key(key);
+
+    for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
+        const TTEntry entry = bucket.entries[i];
+        if (entry.data && (entry.data >> TT_KEY_SHIFT) == check &&
+            tt_live(tt, entry.data)) {
+            return entry;
+        }
+    }
+
+    return TTEntry{0};
 }
 
 bool tt_clear(TT* tt) {
     assert(tt);
 
+    tt_wait(tt);
+
     if (!tt->data) {
         return false;
     }
 
-    memset(tt->data, 0, tt->size * sizeof(TTEntry));
+    tt_parallel(tt->size, [tt](const std::size_t start, const std::size_t end) {
+        memset(tt->data + start, 0, (end - start) * sizeof(TTBucket));
+    });
+    tt->generation = 0;
+    tt->game_generation = 1;
     return true;
 }
 
 bool tt_free(TT* tt) {
     assert(tt);
 
+    tt_wait(tt);
+
     if (!tt->data) {
         return false;
     }
 
     tt->size = 0;
-    free(tt->data);
+    tt->data = nullptr;
+    tt_deallocate(tt->memory, tt->mapping, tt->mapping_size);
     return true;
 }
 
+/* Pick the entry of a bucket to overwrite. */
+/* An entry for the same position is always reused, otherwise the shallowest */
+/* entry is replaced, with entries from older searches counting as shallower. */
+static TTEntry* tt_replace(TT* tt, TTBucket& bucket, const std::uint64_t check) {
+    TTEntry* replace = &bucket.entries[0];
+    int replace_value = INF;
+
+    for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
+        TTEntry* entry = &bucket.entries[i];
+
+        if (!entry->data || (entry->data >> TT_KEY_SHIFT) == check ||
+            !tt_live(tt, entry->data)) {
+            return entry;
+        }
+
+        int age = (tt->generation - tt_generation(entry->data)) & TT_GEN_MASK;
+        int value = tt_depth(entry->data) - 4 * age;
+
+        if (value < replace_value) {
+            replace = entry;
+            replace_value = value;
+        }
+    }
+
+    return replace;
+}
+
 bool tt_add(TT* tt, const std::uint64_t hash_key, const int move,
             const int depth, const int flag, const int eval) {
     assert(tt);
     assert(move != 0);
     assert(depth >= 0);
     assert(flag == TT_EXACT || flag == TT_LOWER || flag == TT_UPPER);
+    assert(eval <= INF + MAX_PLY);
+    assert(eval >= -INF - MAX_PLY);
+
+    if (!tt->data) {
+        return false;
+    }
+
+    std::size_t index = tt_index(tt, hash_key);
+
+    const std::uint64_t check = tt_key(hash_key);
+    TTEntry* entry = tt_replace(tt, tt->data[index], check);
+
+    entry->data = (check << TT_KEY_SHIFT) |
+                  ((std::uint64_t)(move & TT_MOVE_MASK) << TT_MOVE_SHIFT) |
+                  ((std::uint64_t)(depth < TT_DEPTH_MASK ? depth : TT_DEPTH_MASK)
+                   << TT_DEPTH_SHIFT) |
+                  ((std::uint64_t)tt->generation << TT_GEN_SHIFT) |
+                  ((std::uint64_t)(flag & TT_FLAG_MASK) << TT_FLAG_SHIFT) |
+                  ((std::uint64_t)(eval & TT_EVAL_MASK) << TT_EVAL_SHIFT);
+
+    return true;
+}
+
+bool tt_save(const TT* tt, const char* path, const std::uint64_t key_scheme) {
+    assert(tt);
+    assert(path);
 
     if (!tt->data) {
         return false;
     }
 
-    int index = hash_key % tt->size;
+    FILE* f = std::fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+
+    TTFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = TT_FILE_MAGIC;
+    header.version = TT_FILE_VERSION;
+    header.entry_size = sizeof(TTEntry);
+    header.entries = (std::uint64_t)tt->size * TT_BUCKET_SIZE;
+    header.key_scheme = key_scheme;
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+
+    // Stream the table out in chunks rather than one huge write.
+    const std::size_t chunk = 1 << 16;
+    for (std::size_t i = 0; ok && i < (std::size_t)tt->size; i += chunk) {
+        std::size_t count = (std::size_t)tt->size - i;
+        if (count > chunk) count = chunk;
+        ok = std::fwrite(tt->data + i, sizeof(TTBucket), count, f) == count;
+    }
+
+    return std::fclose(f) == 0 && ok;
+}
+
+bool tt_load(TT* tt, const char* path, const std::uint64_t key_scheme) {
+    assert(tt);
+    assert(path);
+
+    FILE* f = std::fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    TTFileHeader header;
+    if (std::fread(&header, sizeof(header), 1, f) != 1 ||
+        header.magic != TT_FILE_MAGIC || header.version != TT_FILE_VERSION ||
+        header.entry_size != sizeof(TTEntry) ||
+        header.key_scheme != key_scheme || header.entries == 0 ||
+        header.entries % TT_BUCKET_SIZE != 0 ||
+        header.entries > SIZE_MAX / sizeof(TTEntry)) {
+        std::fclose(f);
+        return false;
+    }
+
+    const std::size_t buckets = header.entries / TT_BUCKET_SIZE;
+    const std::size_t bytes = sizeof(header) + buckets * sizeof(TTBucket);
+
+#if !defined(_WIN32)
+    // Map the snapshot copy-on-write. Pages are only read in as the search
+    // touches them, and writes never reach the file.
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0 && (std::size_t)st.st_size >= bytes) {
+        void* mapping =
+            mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                 fileno(f), 0);
+
+        if (mapping != MAP_FAILED) {
+            std::fclose(f);
+
+            tt_free(tt);
+            tt->mapping = mapping;
+            tt->mapping_size = bytes;
+            tt->data = (TTBucket*)((char*)mapping + sizeof(header));
+            tt->size = buckets;
+            tt->game_generation = (tt->generation + 1) & TT_GEN_MASK;
+            return true;
+        }
+    }
+#endif
+
+    // Fall back to reading the table into memory.
+    void* memory = malloc(buckets * sizeof(TTBucket) + alignof(TTBucket));
+    TTBucket* data =
+        (TTBucket*)(((std::uintptr_t)memory + alignof(TTBucket) - 1) &
+                    ~(std::uintptr_t)(alignof(TTBucket) - 1));
+    if (!memory ||
+        std::fread(data, sizeof(TTBucket), buckets, f) != buckets) {
+        free(memory);
+        std::fclose(f);
+        return false;
+    }
+    std::fclose(f);
+
+    tt_free(tt);
+    tt->memory = memory;
+    tt->data = data;
+    tt->size = buckets;
+    tt->game_generation = (tt->generation + 1) & TT_GEN_MASK;
+    return true;
+}
+
+bool perft_tt_create(PerftTT* tt, const std::uint64_t megabytes) {
+    assert(tt);
+
+    if (megabytes <= 0) {
+        return false;
+    } else if (megabytes > SIZE_MAX / (1024 * 1024)) {
+        return false;
+    }
+
+    const std::size_t num_buckets =
+        1024 * 1024 * megabytes / sizeof(PerftTTBucket);
 
-    TTEntry entry;
-    entry.data = 0ULL;
-    entry.hash_key = hash_key;
+    tt->data = (PerftTTBucket*)tt_allocate(num_buckets * sizeof(PerftTTBucket),
+                                           tt->memory, tt->mapping,
+                                           tt->mapping_size);
+    tt->size = tt->data ? num_buckets : 0;
 
-    entry.data = ((std::uint64_t)(move & TT_MOVE_MASK) << TT_MOVE_SHIFT) |
-                 ((std::uint64_t)(depth & TT_DEPTH_MASK) << TT_DEPTH_SHIFT) |
-                 ((std::uint64_t)(flag & TT_FLAG_MASK) << TT_FLAG_SHIFT) |
-                 ((std::uint64_t)(eval & TT_EVAL_MASK) << TT_EVAL_SHIFT);
+    return tt->data != nullptr;
+}
 
-    tt->data[index] = entry;
+bool perft_tt_clear(PerftTT* tt) {
+    assert(tt);
 
+    if (!tt->data) {
+        return false;
+    }
+
+    tt_parallel(tt->size, [tt](const std::size_t start, const std::size_t end) {
+        memset(tt->data + start, 0, (end - start) * sizeof(PerftTTBucket));
+    });
     return true;
 }
 
-bool tt_add_perft(TT* tt, const std::uint64_t hash_key, const int depth,
-                  const uint64_t nodes) {
+bool perft_tt_free(PerftTT* tt) {
     assert(tt);
-    assert(depth != 0);
 
     if (!tt->data) {
         return false;
     }
 
-    int index = hash_key % tt->size;
+    tt->size = 0;
+    tt->data = nullptr;
+    tt_deallocate(tt->memory, tt->mapping, tt->mapping_size);
+    return true;
+}
 
-    TTEntry entry;
-    entry.data = 0ULL;
-    entry.hash_key = hash_key;
+bool perft_tt_poll(const PerftTT* tt, const std::uint64_t hash_key,
+                   const std::uint64_t check, const int depth,
+                   std::uint64_t& nodes) {
+    assert(tt);
+    assert(tt->size);
+    assert(tt->data);
+    assert(depth > 0);
+    (void)check;
+
+    const PerftTTBucket& bucket =
+        tt->data[perft_tt_index(tt, hash_key)];
+    const std::uint64_t key = perft_tt_key(hash_key, depth);
+
+    for (int i = 0; i < PERFT_TT_BUCKET_SIZE; ++i) {
+        if (bucket.depths[i] != depth) {
+            continue;
+        }
+
+        // Another thread may be writing the entry, so work on a copy and
+        // only trust it if its words still belong together.
+        const PerftTTEntry entry = bucket.entries[i];
+        if ((entry.key ^ entry.nodes) == key
+#if defined(PERFT_TT_CHECK)
+            && (entry.check ^ entry.nodes) == check
+#endif
+        ) {
+            nodes = entry.nodes;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool perft_tt_add(PerftTT* tt, const std::uint64_t hash_key,
+                  const std::uint64_t check, const int depth,
+                  const std::uint64_t nodes) {
+    assert(tt);
+    assert(depth > 0);
+    assert(depth < 256);
+    (void)check;
 
-    entry.data = ((std::uint64_t)(depth & TT_DEPTH_MASK) << TT_DEPTH_SHIFT) |
-                 ((std::uint64_t)(nodes & TT_NODES_MASK) << TT_NODES_SHIFT);
+    if (!tt->data) {
+        return false;
+    }
+
+    PerftTTBucket& bucket =
+        tt->data[perft_tt_index(tt, hash_key)];
+
+    // Replace the shallowest entry, as deeper ones save the most work. Empty
+    // entries have depth 0, so they go first.
+    int replace = 0;
+    for (int i = 1; i < PERFT_TT_BUCKET_SIZE; ++i) {
+        if (bucket.depths[i] < bucket.depths[replace]) {
+            replace = i;
+        }
+    }
 
-    tt->data[index] = entry;
+    // The key and check are stored XORed with the count, so that an entry torn
+    // by two threads writing it at once fails to verify.
+    PerftTTEntry& entry = bucket.entries[replace];
+    entry.key = perft_tt_key(hash_key, depth) ^ nodes;
+#if defined(PERFT_TT_CHECK)
+    entry.check = check ^ nodes;
+#endif
+    entry.nodes = nodes;
+    bucket.depths[replace] = depth;
 
     return true;
 }
@@ -27,47 +27,174 @@ SOFTWARE.
 #ifndef TT_H
 #define TT_H
 
+#include <cstddef>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <xmmintrin.h>
+#endif
+
 #include "misc.h"
 #include "types.h"
 
 // TTEntry.data layout
-//     Search: Depth (7b) - Eval (32b) - Flag (2b) - Move (18b)
-//     Perft:  Depth (7b) - Nodes (57b)
+//     Search: Key (16b) - Depth (6b) - Generation (6b) - Flag (2b) - Eval (16b)
+//             - Move (18b)
 
-#define TT_DEPTH_SHIFT (0)
-#define TT_EVAL_SHIFT (7)
-#define TT_FLAG_SHIFT (39)
-#define TT_MOVE_SHIFT (41)
-#define TT_NODES_SHIFT (7)
+#define TT_MOVE_SHIFT (0)
+#define TT_EVAL_SHIFT (18)
+#define TT_FLAG_SHIFT (34)
+#define TT_GEN_SHIFT (36)
+#define TT_DEPTH_SHIFT (42)
+#define TT_KEY_SHIFT (48)
 
-#define TT_EVAL_MASK (0xFFFFFFFF)
-#define TT_FLAG_MASK (0x3)
-#define TT_DEPTH_MASK (0x7F)
 #define TT_MOVE_MASK (0x3FFFF)
-#define TT_NODES_MASK (0x1FFFFFFFFFFFFFF)
+#define TT_EVAL_MASK (0xFFFF)
+#define TT_FLAG_MASK (0x3)
+#define TT_GEN_MASK (0x3F)
+#define TT_DEPTH_MASK (0x3F)
+#define TT_KEY_MASK (0xFFFF)
+
+/* Number of entries sharing a cache line */
+#define TT_BUCKET_SIZE (8)
 
 enum flag : int { TT_LOWER = 0, TT_UPPER, TT_EXACT };
 
 /* A transposition table entry */
 struct TTEntry {
     std::uint64_t data;
-    std::uint64_t hash_key;
+};
+
+/* A cache line of transposition table entries */
+struct alignas(64) TTBucket {
+    TTEntry entries[TT_BUCKET_SIZE];
 };
 
 /* The transposition table */
 struct TT {
-    int size;
-    TTEntry* data;
+    std::size_t size;          // Number of buckets.
+    TTBucket* data;
+    std::uint8_t generation;   // Age of the current search.
+    std::uint8_t game_generation;  // Age of the first search of the game.
+    std::thread cleaner;       // Wipes entries from old games.
+    void* memory;              // Allocation backing data, if any.
+    void* mapping;             // Mapping backing data, if any.
+    std::size_t mapping_size;  // Size of the mapping.
+};
+
+/* Transposition table snapshot file format */
+#define TT_FILE_MAGIC (0x0054545F4F4E4F4DULL)  // "MONO_TT"
+#define TT_FILE_VERSION (4)
+
+/* The header of a transposition table snapshot, padded to keep entries */
+/* aligned when the file is mapped. */
+struct TTFileHeader {
+    std::uint64_t magic;
+    std::uint32_t version;
+    std::uint32_t entry_size;
+    std::uint64_t entries;
+    std::uint64_t key_scheme;  // Fingerprint of the Zobrist keys.
+    std::uint8_t padding[32];
+};
+
+/* Perft table entries, optionally verified with a second 64-bit key */
+#if defined(PERFT_TT_CHECK)
+#define PERFT_TT_BUCKET_SIZE (2)
+#else
+#define PERFT_TT_BUCKET_SIZE (3)
+#endif
+
+/* A perft table entry */
+struct PerftTTEntry {
+    std::uint64_t key;
+#if defined(PERFT_TT_CHECK)
+    std::uint64_t check;
+#endif
+    std::uint64_t nodes;
+};
+
+/* A cache line of perft table entries, with depth 0 marking empty ones */
+/* Threads share it without locks, see perft_tt_add() */
+struct alignas(64) PerftTTBucket {
+    PerftTTEntry entries[PERFT_TT_BUCKET_SIZE];
+    std::uint8_t depths[PERFT_TT_BUCKET_SIZE];
+};
+
+/* The perft table, kept apart so perft doesn't wipe the search's entries */
+struct PerftTT {
+    std::size_t size;  // Number of buckets.
+    PerftTTBucket* data;
+    void* memory;
+    void* mapping;
+    std::size_t mapping_size;
 };
 
-extern bool tt_create(TT* tt, const std::uint32_t megabytes);
+extern bool tt_create(TT* tt, const std::uint64_t megabytes);
+extern void tt_new_search(TT* tt);
+extern void tt_new_game(TT* tt);
+extern void tt_wait(TT* tt);
 extern TTEntry tt_poll(TT* tt, const std::uint64_t key);
 extern bool tt_clear(TT* tt);
 extern bool tt_free(TT* tt);
 extern bool tt_add(TT* tt, const std::uint64_t hash_key, const int move,
                    const int depth, const int flag, const int eval);
-extern bool tt_add_perft(TT* tt, const std::uint64_t hash_key, const int depth,
-                         const uint64_t nodes);
+extern bool tt_save(const TT* tt, const char* path,
+                    const std::uint64_t key_scheme);
+extern bool tt_load(TT* tt, const char* path, const std::uint64_t key_scheme);
+
+extern bool perft_tt_create(PerftTT* tt, const std::uint64_t megabytes);
+extern bool perft_tt_clear(PerftTT* tt);
+extern bool perft_tt_free(PerftTT* tt);
+extern bool perft_tt_poll(const PerftTT* tt, const std::uint64_t hash_key,
+                          const std::uint64_t check, const int depth,
+                          std::uint64_t& nodes);
+extern bool perft_tt_add(PerftTT* tt, const std::uint64_t hash_key,
+                         const std::uint64_t check, const int depth,
+                         const std::uint64_t nodes);
+
+/* Scale a key onto a table size by multiplying and keeping the high bits. */
+inline std::size_t scale_key(const std::uint64_t key, const std::size_t size) {
+#if defined(__GNUC__)
+    return (std::size_t)(((unsigned __int128)key * size) >> 64);
+#elif defined(_MSC_VER)
+    return (std::size_t)__umulh(key, size);
+#endif
+}
+
+/* Get the bucket of a key. */
+/* This uses the high bits of the key, so the entry keeps the low bits. */
+inline std::size_t tt_index(const TT* tt, const std::uint64_t key) {
+    return scale_key(key, tt->size);
+}
+
+/* Get the perft table bucket of a key. */
+inline std::size_t perft_tt_index(const PerftTT* tt, const std::uint64_t key) {
+    return scale_key(key, tt->size);
+}
+
+/* Get the key a perft table entry is verified with, which also covers the */
+/* depth so the depths can be read and written without any locking. */
+inline std::uint64_t perft_tt_key(const std::uint64_t hash_key,
+                                  const int depth) {
+    return hash_key ^ (depth * 0x9E3779B97F4A7C15ULL);
+}
+
+/* Was an entry stored during the current game? */
+/* Entries from before the game started are treated as empty. */
+inline bool tt_live(const TT* tt, const std::uint64_t data) {
+    const int age = (tt->generation - (data >> TT_GEN_SHIFT)) & TT_GEN_MASK;
+    return age <= ((tt->generation - tt->game_generation) & TT_GEN_MASK);
+}
+
+/* Start loading the bucket of a key into cache ahead of a tt_poll(). */
+inline void tt_prefetch(const TT* tt, const std::uint64_t key) {
+#if defined(__GNUC__)
+    __builtin_prefetch(&tt->data[tt_index(tt, key)]);
+#elif defined(_MSC_VER)
+    _mm_prefetch((const char*)&tt->data[tt_index(tt, key)], _MM_HINT_T0);
+#endif
+}
 
 inline int eval_to_tt(const int eval, const int ply) {
     assert(ply >= 0);
@@ -93,26 +220,25 @@ inline int eval_from_tt(const int eval, const int ply) {
     return eval;
 }
 
+/* Get the 16 bits of a hash key stored in its transposition table entry */
+inline std::uint64_t tt_key(const std::uint64_t hash_key) {
+    return hash_key & TT_KEY_MASK;
+}
+
 /* Get the transposition table entry depth */
 inline int tt_depth(const std::uint64_t data) {
     int depth = (data >> TT_DEPTH_SHIFT) & TT_DEPTH_MASK;
     assert(depth >= 0);
     assert(depth < MAX_PLY);
     return depth;
-
-    // return (data >> TT_DEPTH_SHIFT) & TT_DEPTH_MASK;
 }
 
 /* Get the transposition table entry eval */
 inline int tt_eval(const std::uint64_t data) {
-    int eval = (data >> TT_EVAL_SHIFT) & TT_EVAL_MASK;
+    int eval = (std::int16_t)((data >> TT_EVAL_SHIFT) & TT_EVAL_MASK);
     assert(eval <= INF + MAX_PLY);
     assert(eval >= -INF - MAX_PLY);
-    // assert(eval <= INF);
-    // assert(eval >= -INF);
     return eval;
-
-    // return (data >> TT_EVAL_SHIFT) & TT_EVAL_MASK;
 }
 
 /* Get the transposition table entry flag */
@@ -120,19 +246,16 @@ inline int tt_flag(const std::uint64_t data) {
     int flag = (data >> TT_FLAG_SHIFT) & TT_FLAG_MASK;
     assert(flag == TT_EXACT || flag == TT_LOWER || flag == TT_UPPER);
     return flag;
-
-    // return (data >> TT_FLAG_SHIFT) & TT_FLAG_MASK;
 }
 
 /* Get the transposition table entry move */
 inline int tt_move(const std::uint64_t data) {
     return (data >> TT_MOVE_SHIFT) & TT_MOVE_MASK;
-    // return (Move)((data >> TT_MOVE_SHIFT) & TT_MOVE_MASK);
 }
 
-/* Get the transposition table entry node count for TT perft */
-inline int tt_nodes(const std::uint64_t data) {
-    return (data >> TT_NODES_SHIFT) & TT_NODES_MASK;
+/* Get the transposition table entry generation */
+inline int tt_generation(const std::uint64_t data) {
+    return (data >> TT_GEN_SHIFT) & TT_GEN_MASK;
 }
 
 #endif
@@ -0,0 +1,601 @@
+/*
+MIT License
+
+Copyright (c) 2017 CPirc
+Copyright (c) 2018 CPirc
+Copyright (c) 2019 CPirc
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "analyse.h"
+#include "eval.h"
+#include "misc.h"
+#include "move.h"
+#include "position.h"
+#include "tune.h"
+
+/* Lines read and turned into positions at a time */
+#define TUNE_BLOCK_LINES (1 << 16)
+
+/* A parameter of a position's evaluation and how often it counts */
+struct TuneTerm {
+    std::uint16_t index;
+    std::int16_t coefficient;
+};
+
+/* A labelled position, with its terms in TuneData::terms */
+struct TuneEntry {
+    std::uint32_t first;   // Index of the first term.
+    std::uint16_t count;   // Number of terms.
+    std::uint8_t phase;    // Phase of the side to move.
+    std::uint8_t result;   // 0 for a loss, 1 for a draw, 2 for a win.
+    std::int16_t opening;  // Terms that aren't tuned, from white's side.
+    std::int16_t endgame;
+};
+
+/* The positions of a tuning run, keeping only the parameters that count */
+struct TuneData {
+    std::vector<TuneEntry> entries;
+    std::vector<TuneTerm> terms;
+};
+
+/* The parameters in both phases, zero where a parameter isn't scored */
+struct TuneParams {
+    double opening[EVAL_PARAMS];
+    double endgame[EVAL_PARAMS];
+};
+
+/* Find the game result of an EPD line, from white's side. Results are */
+/* given as c9 "1-0" among the operations or as [1.0] ending the line. */
+static bool parse_result(const std::string& ops, std::uint8_t& result) {
+    static const char* const c9_results[3] = {"c9 \"0-1\"", "c9 \"1/2-1/2\"",
+                                              "c9 \"1-0\""};
+    static const char* const bracketed[3] = {"[0.0]", "[0.5]", "[1.0]"};
+
+    const std::size_t last = ops.find_last_not_of(" \t\r;");
+    const std::string end =
+        last != std::string::npos && last >= 4 ? ops.substr(last - 4, 5) : "";
+
+    for (int r = 0; r < 3; ++r) {
+        if (ops.find(c9_results[r]) != std::string::npos ||
+            end == bracketed[r]) {
+            result = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Can the position be evaluated? */
+static bool position_valid(const Position& pos) {
+    return popcnt(get_piece(pos, KING, WHITE)) == 1 &&
+           popcnt(get_piece(pos, KING, BLACK)) == 1 &&
+           !is_checked(pos, ~pos.side);
+}
+
+/* Follow the captures of a position to the quiet position the */
+/* quiescence search scores it by. */
+static int resolve(const Position& pos, int alpha, const int beta,
+                   const int ply, Position& leaf) {
+    leaf = pos;
+
+    const int value = evaluate(pos);
+    if (value >= beta || ply >= MAX_PLY) {
+        return value;
+    }
+    if (value > alpha) {
+        alpha = value;
+    }
+
+    Move moves[256];
+    const int movecount = generate_captures(pos, moves);
+
+    // Take the most valuable victims first.
+    std::sort(moves, moves + movecount, [&pos](const Move a, const Move b) {
+        return piecevals[OPENING][get_piece_on_square(pos, to_square(a))] >
+               piecevals[OPENING][get_piece_on_square(pos, to_square(b))];
+    });
+
+    for (int i = 0; i < movecount; ++i) {
+        Position npos = pos;
+        make_move(npos, moves[i]);
+        if (is_checked(npos, ~npos.side)) {
+            continue;
+        }
+
+        Position child_leaf;
+        const int score = -resolve(npos, -beta, -alpha, ply + 1, child_leaf);
+        if (score > alpha) {
+            alpha = score;
+            leaf = child_leaf;
+            if (score >= beta) {
+                break;
+            }
+        }
+    }
+
+    return alpha;
+}
+
+#ifndef NDEBUG
+/* Evaluate a trace with the engine's parameters, as evaluate() does. */
+static int trace_eval(const EvalTrace& trace, const EvalParam* params) {
+    int opening = trace.opening, endgame = trace.endgame;
+    for (int i = 0; i < EVAL_PARAMS; ++i) {
+        const int score = trace.coefficients[i] * *params[i].value;
+        opening += params[i].phase != PARAM_ENDGAME ? score : 0;
+        endgame += params[i].phase != PARAM_OPENING ? score : 0;
+    }
+    return (trace.phase * opening + (24 - trace.phase) * endgame) / 24;
+}
+#endif
+
+/* Turn EPD lines into entries. */
+static void add_lines(const std::vector<std::string>& lines,
+                      const std::size_t begin, const std::size_t end,
+                      const bool resolve_captures, const EvalParam* params,
+                      TuneData& data) {
+    (void)params;
+
+    EvalTrace trace;
+    for (std::size_t i = begin; i < end; ++i) {
+        std::string fen, ops;
+        TuneEntry entry;
+        if (!epd_to_fen(lines[i], fen, ops) ||
+            !parse_result(ops, entry.result)) {
+            continue;
+        }
+
+        Position pos;
+        parse_fen_to_position(fen.c_str(), pos);
+        if (!position_valid(pos)) {
+            continue;
+        }
+
+        if (resolve_captures) {
+            Position leaf;
+            resolve(pos, -INF, INF, 0, leaf);
+            pos = leaf;
+        }
+
+        evaluate_trace(pos, trace);
+        assert(trace_eval(trace, params) ==
+               (pos.side == WHITE ? evaluate(pos) : -evaluate(pos)));
+
+        entry.first = data.terms.size();
+        entry.count = 0;
+        entry.phase = trace.phase;
+        entry.opening = trace.opening;
+        entry.endgame = trace.endgame;
+        for (int j = 0; j < EVAL_PARAMS; ++j) {
+            if (trace.coefficients[j]) {
+                data.terms.push_back(
+                    TuneTerm{std::uint16_t(j), trace.coefficients[j]});
+                ++entry.count;
+            }
+        }
+        data.entries.push_back(entry);
+    }
+}
+
+/* Load a dataset, turning the lines of each block into entries in */
+/* parallel. */
+static bool load_data(const char* path, const TuneOptions& options,
+                      const EvalParam* params, TuneData& data) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+
+    std::vector<std::string> lines;
+    std::vector<TuneData> parts(options.threads);
+    std::string line;
+    bool more = true;
+    while (more) {
+        lines.clear();
+        while (lines.size() < TUNE_BLOCK_LINES &&
+               (more = (bool)std::getline(in, line))) {
+            lines.push_back(line);
+        }
+
+        const std::size_t per_thread =
+            (lines.size() + options.threads - 1) / options.threads;
+        std::vector<std::thread> workers;
+        for (int t = 0; t < options.threads; ++t) {
+            const std::size_t begin = std::min(t * per_thread, lines.size());
+            const std::size_t end = std::min(begin + per_thread, lines.size());
+            parts[t].entries.clear();
+            parts[t].terms.clear();
+            workers.emplace_back(add_lines, std::cref(lines), begin, end,
+                                 options.resolve, params, std::ref(parts[t]));
+        }
+
+        for (int t = 0; t < options.threads; ++t) {
+            workers[t].join();
+
+            const std::uint32_t offset = data.terms.size();
+            for (TuneEntry entry : parts[t].entries) {
+                entry.first += offset;
+                data.entries.push_back(entry);
+            }
+            data.terms.insert(data.terms.end(), parts[t].terms.begin(),
+                              parts[t].terms.end());
+        }
+    }
+
+    return true;
+}
+
+/* Evaluate an entry from white's side. */
+inline double entry_eval(const TuneData& data, const TuneEntry& entry,
+                         const TuneParams& params) {
+    double opening = entry.opening, endgame = entry.endgame;
+    const TuneTerm* terms = &data.terms[entry.first];
+    for (int i = 0; i < entry.count; ++i) {
+        opening += terms[i].coefficient * params.opening[terms[i].index];
+        endgame += terms[i].coefficient * params.endgame[terms[i].index];
+    }
+    return (entry.phase * opening + (24 - entry.phase) * endgame) / 24;
+}
+
+/* Get the expected result of a score from white's side. */
+inline double sigmoid(const double k, const double eval) {
+    return 1.0 / (1.0 + std::pow(10.0, -k * eval / 400.0));
+}
+
+/* Run a job over the entries, split into ranges between threads, and add */
+/* up what the ranges return. */
+template <typename Job>
+static double parallel_sum(const TuneData& data, const int threads,
+                           const Job& job) {
+    const std::size_t size = data.entries.size();
+    const std::size_t per_thread = (size + threads - 1) / threads;
+
+    std::vector<double> sums(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        const std::size_t begin = std::min(t * per_thread, size);
+        const std::size_t end = std::min(begin + per_thread, size);
+        workers.emplace_back([&, t, begin, end]() {
+            sums[t] = job(t, begin, end);
+        });
+    }
+
+    double sum = 0;
+    for (int t = 0; t < threads; ++t) {
+        workers[t].join();
+        sum += sums[t];
+    }
+    return sum;
+}
+
+/* Get the mean squared error of the expected results. */
+static double mean_error(const TuneData& data, const TuneParams& params,
+                         const double k, const int threads) {
+    const double sum = parallel_sum(
+        data, threads, [&](int, std::size_t begin, std::size_t end) {
+            double error = 0;
+            for (std::size_t i = begin; i < end; ++i) {
+                const TuneEntry& entry = data.entries[i];
+                const double diff = entry.result / 2.0 -
+                                    sigmoid(k, entry_eval(data, entry, params));
+                error += diff * diff;
+            }
+            return error;
+        });
+    return sum / data.entries.size();
+}
+
+/* Find the scaling of scores that fits the results best, by golden */
+/* section search. */
+static double fit_k(const TuneData& data, const TuneParams& params,
+                    const int threads) {
+    const double ratio = (std::sqrt(5.0) - 1) / 2;
+    double low = 0.0, high = 4.0;
+    double a = high - ratio * (high - low), b = low + ratio * (high - low);
+    double error_a = mean_error(data, params, a, threads);
+    double error_b = mean_error(data, params, b, threads);
+
+    while (high - low > 1e-4) {
+        if (error_a < error_b) {
+            high = b;
+            b = a;
+            error_b = error_a;
+            a = high - ratio * (high - low);
+            error_a = mean_error(data, params, a, threads);
+        } else {
+            low = a;
+            a = b;
+            error_a = error_b;
+            b = low + ratio * (high - low);
+            error_b = mean_error(data, params, b, threads);
+        }
+    }
+
+    return (low + high) / 2;
+}
+
+/* Get the gradient of the mean squared error. Each thread adds up its */
+/* entries' gradients by phase into its own rows. */
+static void gradient(const TuneData& data, const TuneParams& params,
+                     const EvalParam* eval_params, const double k,
+                     const int threads, double* grad) {
+    std::vector<TuneParams> rows(threads);
+    parallel_sum(data, threads, [&](int t, std::size_t begin, std::size_t end) {
+        TuneParams& row = rows[t];
+        std::fill(row.opening, row.opening + EVAL_PARAMS, 0.0);
+        std::fill(row.endgame, row.endgame + EVAL_PARAMS, 0.0);
+
+        for (std::size_t i = begin; i < end; ++i) {
+            const TuneEntry& entry = data.entries[i];
+            const double s = sigmoid(k, entry_eval(data, entry, params));
+            const double d = (entry.result / 2.0 - s) * s * (1 - s);
+            const double d_opening = d * entry.phase / 24;
+            const double d_endgame = d * (24 - entry.phase) / 24;
+
+            const TuneTerm* terms = &data.terms[entry.first];
+            for (int j = 0; j < entry.count; ++j) {
+                row.opening[terms[j].index] += d_opening * terms[j].coefficient;
+                row.endgame[terms[j].index] += d_endgame * terms[j].coefficient;
+            }
+        }
+        return 0.0;
+    });
+
+    // d error / d eval = -2 (result - s) s (1 - s) k ln(10) / 400 / size
+    const double scale =
+        -2.0 * k * std::log(10.0) / 400.0 / data.entries.size();
+    for (int i = 0; i < EVAL_PARAMS; ++i) {
+        double sum = 0;
+        for (const TuneParams& row : rows) {
+            sum += eval_params[i].phase != PARAM_ENDGAME ? row.opening[i] : 0;
+            sum += eval_params[i].phase != PARAM_OPENING ? row.endgame[i] : 0;
+        }
+        grad[i] = scale * sum;
+    }
+}
+
+/* Set up the parameters in both phases from a parameter vector. */
+static void set_params(const EvalParam* eval_params, const double* values,
+                       TuneParams& params) {
+    for (int i = 0; i < EVAL_PARAMS; ++i) {
+        params.opening[i] =
+            eval_params[i].phase != PARAM_ENDGAME ? values[i] : 0;
+        params.endgame[i] =
+            eval_params[i].phase != PARAM_OPENING ? values[i] : 0;
+    }
+}
+
+/* Write a table of parameters, a row of eight to a line. */
+static void write_table(FILE* f, const int* values, const int count) {
+    for (int i = 0; i < count; ++i) {
+        std::fprintf(f, "%s%3d%s", i % 8 ? " " : "        ", values[i],
+                     i + 1 < count ? "," : "");
+        if (i % 8 == 7) {
+            std::fprintf(f, "\n");
+        }
+    }
+}
+
+static const char* const psqt_license =
+    "/*\n"
+    "MIT License\n"
+    "\n"
+    "Copyright (c) 2017 CPirc\n"
+    "Copyright (c) 2018 CPirc\n"
+    "Copyright (c) 2019 CPirc\n"
+    "\n"
+    "Permission is hereby granted, free of charge, to any person obtaining "
+    "a copy\n"
+    "of this software and associated documentation files (the "
+    "\"Software\"), to deal\n"
+    "in the Software without restriction, including without limitation the "
+    "rights\n"
+    "to use, copy, modify, merge, publish, distribute, sublicense, and/or "
+    "sell\n"
+    "copies of the Software, and to permit persons to whom the Software is\n"
+    "furnished to do so, subject to the following conditions:\n"
+    "\n"
+    "The above copyright notice and this permission notice shall be "
+    "included in all\n"
+    "copies or substantial portions of the Software.\n"
+    "\n"
+    "THE SOFTWARE IS PROVIDED \"AS IS\", WITHOUT WARRANTY OF ANY KIND, "
+    "EXPRESS OR\n"
+    "IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF "
+    "MERCHANTABILITY,\n"
+    "FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL "
+    "THE\n"
+    "AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER\n"
+    "LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING "
+    "FROM,\n"
+    "OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS "
+    "IN THE\n"
+    "SOFTWARE.\n"
+    "*/\n";
+
+/* Lines up the second row of piecevals under the first */
+#define INDENT_PIECEVALS "                             "
+
+/* The tables of psqt.h */
+struct PsqtTables {
+    int piecevals[2][7];
+    int mobility_weights[7];
+    int passed_pawn_bonus[8];
+    int pst[6][2][64];
+};
+
+/* Set the entry of a copy of a table that a parameter points to in the */
+/* engine's table, if the parameter is in that table. */
+static bool set_entry(int* copy, const int* table, const std::size_t size,
+                      const int* param, const int value) {
+    if (param < table || param >= table + size) {
+        return false;
+    }
+    copy[param - table] = value;
+    return true;
+}
+
+/* Write the engine's parameters, with the tunable ones set to some values, */
+/* out in the layout of psqt.h. The engine's tables are left alone. */
+static bool write_psqt(const char* path, const EvalParam* eval_params,
+                       const double* values) {
+    static const char* const pieces[6] = {"Pawns", "Knights", "Bishops",
+                                          "Rooks", "Queens",  "King"};
+
+    PsqtTables t;
+    std::memcpy(t.piecevals, piecevals, sizeof(t.piecevals));
+    std::memcpy(t.mobility_weights, mobility_weights,
+                sizeof(t.mobility_weights));
+    std::memcpy(t.passed_pawn_bonus, passed_pawn_bonus,
+                sizeof(t.passed_pawn_bonus));
+    std::memcpy(t.pst, pst, sizeof(t.pst));
+
+    for (int i = 0; i < EVAL_PARAMS; ++i) {
+        const int* param = eval_params[i].value;
+        const int value = values[i];
+        const bool found =
+            set_entry(&t.piecevals[0][0], &piecevals[0][0], 2 * 7, param,
+                      value) ||
+            set_entry(t.mobility_weights, mobility_weights, 7, param, value) ||
+            set_entry(t.passed_pawn_bonus, passed_pawn_bonus, 8, param,
+                      value) ||
+            set_entry(&t.pst[0][0][0], &pst[0][0][0], 6 * 2 * 64, param,
+                      value);
+        assert(found);
+        (void)found;
+    }
+
+    FILE* f = std::fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+
+    std::fprintf(f, "%s\n", psqt_license);
+
+    std::fprintf(f, "/* Piece values for material in centipawns. */\n");
+    std::fprintf(f, "const int piecevals[2][7] = {");
+    for (int phase = OPENING; phase <= ENDGAME; ++phase) {
+        std::fprintf(f, "%s{", phase == OPENING ? "" : ",\n" INDENT_PIECEVALS);
+        for (int p = 0; p < 7; ++p) {
+            std::fprintf(f, "%d%s", t.piecevals[phase][p], p < 6 ? ", " : "}");
+        }
+    }
+    std::fprintf(f, "};\n\n");
+
+    std::fprintf(f, "/* Mobility weights for material. */\n");
+    std::fprintf(f, "const int mobility_weights[7] = {");
+    for (int p = 0; p < 7; ++p) {
+        std::fprintf(f, "%d%s", t.mobility_weights[p], p < 6 ? ", " : "};\n\n");
+    }
+
+    std::fprintf(f, "/* Passed pawn advancement bonus. */\n");
+    std::fprintf(f, "const int passed_pawn_bonus[8] = {");
+    for (int r = 0; r < 8; ++r) {
+        std::fprintf(f, "%d%s", t.passed_pawn_bonus[r],
+                     r < 7 ? ", " : "};\n\n");
+    }
+
+    std::fprintf(f, "/* PST values in centipawns. */\n");
+    std::fprintf(f, "const int pst[6][2][64] = {\n");
+    for (int p = 0; p < 6; ++p) {
+        std::fprintf(f, "    { // %s\n", pieces[p]);
+        for (int phase = OPENING; phase <= ENDGAME; ++phase) {
+            std::fprintf(f, "        { // %s\n",
+                         phase == OPENING ? "Middlegame" : "Endgame");
+            write_table(f, t.pst[p][phase], 64);
+            std::fprintf(f, "        }%s\n", phase == OPENING ? "," : "");
+        }
+        std::fprintf(f, "    }%s\n", p < 5 ? "," : "");
+    }
+    std::fprintf(f, "};\n");
+
+    return std::fclose(f) == 0;
+}
+
+/* Tune the evaluation parameters to the results of a dataset with Adam */
+/* and write them out as psqt.h. The engine's parameters are left as they */
+/* were. */
+bool tune(const char* data_path, const char* out_path,
+          const TuneOptions& options, TuneResult& result) {
+    assert(options.threads > 0);
+
+    EvalParam eval_params[EVAL_PARAMS];
+    ::eval_params(eval_params);
+
+    TuneData data;
+    if (!load_data(data_path, options, eval_params, data) ||
+        data.entries.empty()) {
+        return false;
+    }
+
+    std::vector<double> values(EVAL_PARAMS);
+    for (int i = 0; i < EVAL_PARAMS; ++i) {
+        values[i] = *eval_params[i].value;
+    }
+
+    TuneParams params;
+    set_params(eval_params, values.data(), params);
+
+    result.positions = data.entries.size();
+    result.k = fit_k(data, params, options.threads);
+    result.start_error = mean_error(data, params, result.k, options.threads);
+
+    const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8;
+    std::vector<double> grad(EVAL_PARAMS), m(EVAL_PARAMS), v(EVAL_PARAMS);
+    for (int epoch = 1; epoch <= options.epochs; ++epoch) {
+        gradient(data, params, eval_params, result.k, options.threads,
+                 grad.data());
+
+        for (int i = 0; i < EVAL_PARAMS; ++i) {
+            m[i] = beta1 * m[i] + (1 - beta1) * grad[i];
+            v[i] = beta2 * v[i] + (1 - beta2) * grad[i] * grad[i];
+            const double m_hat = m[i] / (1 - std::pow(beta1, epoch));
+            const double v_hat = v[i] / (1 - std::pow(beta2, epoch));
+            values[i] -= options.rate * m_hat / (std::sqrt(v_hat) + epsilon);
+        }
+        set_params(eval_params, values.data(), params);
+
+        if (epoch % 100 == 0) {
+            std::printf("info string epoch %d error %.6f\n", epoch,
+                        mean_error(data, params, result.k, options.threads));
+            std::fflush(stdout);
+        }
+    }
+
+    // Score with the rounded parameters the engine will use.
+    for (int i = 0; i < EVAL_PARAMS; ++i) {
+        values[i] = std::round(values[i]);
+    }
+    set_params(eval_params, values.data(), params);
+    result.end_error = mean_error(data, params, result.k, options.threads);
+
+    return write_psqt(out_path, eval_params, values.data());
+}
@@ -0,0 +1,51 @@
+/*
+MIT License
+
+Copyright (c) 2017 CPirc
+Copyright (c) 2018 CPirc
+Copyright (c) 2019 CPirc
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <cstddef>
+
+/* Settings of a tuning run. */
+struct TuneOptions {
+    int epochs;    // Gradient steps over the whole dataset.
+    int threads;   // Number of workers.
+    double rate;   // Step size in centipawns.
+    bool resolve;  // Score the quiet position captures lead to.
+};
+
+/* The outcome of a tuning run. */
+struct TuneResult {
+    std::size_t positions;  // Positions that could be used.
+    double k;               // Scaling of scores to expected results.
+    double start_error;     // Mean squared error of the evaluation before
+    double end_error;       // and after tuning.
+};
+
+extern bool tune(const char* data_path, const char* out_path,
+                 const TuneOptions& options, TuneResult& result);
+
+#endif
@@ -44,7 +44,7 @@ enum Piece : unsigned char {
 const char Piece_ASCII[7] = {'P', 'N', 'B', 'R', 'Q', 'K', '-'};
 
 /* Colours on a chessboard: */
-enum Colour : unsigned char { US, THEM };
+enum Colour : unsigned char { WHITE, BLACK };
 
 /* Squares on a chessboard */
 enum Square : unsigned char {
@@ -84,11 +84,30 @@ enum File : unsigned char {
 };
 
 /* Castling rights. */
-enum { US_OO = 1, US_OOO = 2, THEM_OO = 4, THEM_OOO = 8 };
+enum { WHITE_OO = 1, WHITE_OOO = 2, BLACK_OO = 4, BLACK_OOO = 8 };
 
 /* Material phases. */
 enum Phase { OPENING, ENDGAME };
 
+/* An opening and an endgame score packed into one integer. */
+/* The endgame score is in the high 16 bits, the opening in the low 16. */
+typedef std::int32_t Score;
+
+/* Pack an opening and an endgame score. */
+constexpr inline Score make_score(const int opening, const int endgame) {
+    return Score((int)((unsigned int)endgame << 16) + opening);
+}
+
+/* Get the opening score of a packed score. */
+constexpr inline int opening_score(const Score s) {
+    return (std::int16_t)(std::uint16_t)(unsigned int)s;
+}
+
+/* Get the endgame score of a packed score. */
+constexpr inline int endgame_score(const Score s) {
+    return (std::int16_t)(std::uint16_t)((unsigned int)(s + 0x8000) >> 16);
+}
+
 #define ENABLE_OPERATIONS(T)                                                  \
     constexpr inline T operator+(T l, T r) { return T((int)(l) + (int)(r)); } \
     constexpr inline T operator+(T l, int r) { return T((int)(l) + r); }      \
@@ -107,4 +126,26 @@ ENABLE_OPERATIONS(Square)
 ENABLE_OPERATIONS(Rank)
 ENABLE_OPERATIONS(File)
 
+/* Get the other colour. */
+constexpr inline Colour operator~(Colour c) { return Colour(c ^ 1); }
+
+/* Get a square as seen from a colour's side of the board. */
+constexpr inline Square relative_square(Colour c, Square sq) {
+    return c == WHITE ? sq : Square(sq ^ 56);
+}
+
+/* Get a rank as seen from a colour's side of the board. */
+constexpr inline Rank relative_rank(Colour c, Rank r) {
+    return c == WHITE ? r : Rank(RANK_8 - r);
+}
+
+/* A fixed-size array that a constexpr function can fill at compile time. */
+template <typename T, int N>
+struct Table {
+    T data[N];
+
+    constexpr T& operator[](const int i) { return data[i]; }
+    constexpr const T& operator[](const int i) const { return data[i]; }
+};
+
 #endif
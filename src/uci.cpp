@@ -24,22 +24,102 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <thread>
 
+#include "analyse.h"
+#include "book.h"
 #include "move.h"
+#include "nnue.h"
 #include "position.h"
 #include "search.h"
+#include "tune.h"
 #include "uci.h"
 
+/* Hash table sizes in megabytes */
+#define HASH_DEFAULT_MB (128)
+#define HASH_MAX_MB (1024 * 1024)
+#define PERFT_HASH_DEFAULT_MB (256)
+
+/* Ply at which parallel perft hands subtrees to its threads */
+#define PERFT_SPLIT_DEFAULT (2)
+
+/* Gradient steps of a tuning run and their size in centipawns */
+#define TUNE_EPOCHS_DEFAULT (1000)
+#define TUNE_RATE_DEFAULT (1.0)
+
 static SearchController sc;
+static TT tt;
+static PerftTT ptt;
+static Book book;
+static std::uint64_t hash_megabytes = HASH_DEFAULT_MB;
+static std::uint64_t perft_hash_megabytes = PERFT_HASH_DEFAULT_MB;
+static std::thread search_thread;
 
 namespace UCI {
+/* Stop a running search, and wait for it to print its bestmove. */
+static void stop() {
+    if (search_thread.joinable()) {
+        sc.stopped = true;
+        search_thread.join();
+    }
+}
+
 namespace Extension {
-void print() { print_position(sc.pos); }
+void print() {
+    print_position(sc.pos);
 
+    std::cout << "History: " << sc.history.size << std::endl;
+    for (int i = 0; i < sc.history.size; ++i) {
+        std::cout << "  " << std::hex << sc.history.keys[i] << std::dec
+                  << std::endl;
+    }
+}
+
+/* Allocate the perft table the first time it is used. Its entries stay */
+/* valid between runs, so it is not cleared. */
+static bool perft_hash_ready() {
+    if (!ptt.data && !perft_tt_create(&ptt, perft_hash_megabytes)) {
+        std::cout << "info string could not allocate " << perft_hash_megabytes
+                  << " MB of perft hash" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/* Read the threads and split ply of a perft command. */
+static void perft_options(const std::string& word, std::stringstream& ss,
+                          int& threads, int& split) {
+    if (word == "threads") {
+        ss >> threads;
+        if (threads < 1) {
+            threads = 1;
+        }
+    } else if (word == "split") {
+        ss >> split;
+    }
+}
+
+/* Count the leaves of a perft command's tree. */
+static std::uint64_t perft_count(Position& pos, const int depth,
+                                 const std::string& strategy,
+                                 const int threads, const int split) {
+    if (threads) {
+        return perft_parallel(&ptt, pos, depth, threads, split);
+    } else if (strategy == "copy") {
+        return ::perft<CopyMake>(pos, depth);
+    } else if (strategy == "unmake") {
+        return ::perft<MakeUnmake>(pos, depth);
+    }
+    return ::perft(pos, depth);
+}
+
+// perft <depth> [copy|unmake] [divide] [threads N] [split P]
 void perft(std::stringstream& ss) {
     int depth = 0;
     ss >> depth;
@@ -47,22 +127,70 @@ void perft(std::stringstream& ss) {
         depth = 1;
     }
 
+    // Optionally pick the move making strategy, to compare them, or split
+    // the tree over threads that share the perft table.
+    std::string strategy;
+    bool divide = false;
+    int threads = 0;
+    int split = PERFT_SPLIT_DEFAULT;
+    std::string word;
+    while (ss >> word) {
+        if (word == "copy" || word == "unmake") {
+            strategy = word;
+        } else if (word == "divide") {
+            divide = true;
+        } else {
+            perft_options(word, ss, threads, split);
+        }
+    }
+
+    if (threads && !perft_hash_ready()) {
+        return;
+    }
+
     std::uint64_t nodes = 0ULL;
+
+    // Count the tree below each root move, to compare against another
+    // engine and find the move it disagrees on.
+    if (divide) {
+        Move moves[256];
+        int movecount = generate(sc.pos, moves);
+        for (int i = 0; i < movecount; ++i) {
+            Position npos = sc.pos;
+            make_move(npos, moves[i]);
+            if (is_checked(npos, ~npos.side)) continue;
+
+            const std::uint64_t count =
+                perft_count(npos, depth - 1, strategy, threads, split);
+            nodes += count;
+
+            char lan[6];
+            move_to_lan(lan, moves[i]);
+            std::cout << lan << ": " << count << std::endl;
+        }
+
+        std::cout << "nodes " << nodes << std::endl;
+        return;
+    }
+
     for (int i = 1; i <= depth; ++i) {
         auto start = std::chrono::high_resolution_clock::now();
-        nodes = perft(sc.pos, i);
+        nodes = perft_count(sc.pos, i, strategy, threads, split);
         auto finish = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> elapsed = finish - start;
 
         std::cout << "info"
                   << " depth " << i << " nodes " << nodes << " time "
-                  << static_cast<int>(elapsed.count() * 1000) << " nps "
-                  << static_cast<int>(nodes / elapsed.count()) << std::endl;
+                  << static_cast<std::uint64_t>(elapsed.count() * 1000)
+                  << " nps "
+                  << static_cast<std::uint64_t>(nodes / elapsed.count())
+                  << std::endl;
     }
 
     std::cout << "nodes " << nodes << std::endl;
 }
 
+// ttperft <depth> [threads N] [split P]
 void ttperft(std::stringstream& ss) {
     int depth = 0;
     ss >> depth;
@@ -70,30 +198,315 @@ void ttperft(std::stringstream& ss) {
         depth = 1;
     }
 
+    int threads = 1;
+    int split = PERFT_SPLIT_DEFAULT;
+    std::string word;
+    while (ss >> word) {
+        perft_options(word, ss, threads, split);
+    }
+
+    if (!perft_hash_ready()) {
+        return;
+    }
+
     std::uint64_t nodes = 0ULL;
     for (int i = 1; i <= depth; ++i) {
         auto start = std::chrono::high_resolution_clock::now();
-        nodes = perft_tt(&sc.tt, sc.pos, i);
+        if (threads > 1) {
+            nodes = perft_parallel(&ptt, sc.pos, i, threads, split);
+        } else {
+            nodes = perft_tt(&ptt, sc.pos, i);
+        }
         auto finish = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> elapsed = finish - start;
 
         std::cout << "info"
                   << " depth " << i << " nodes " << nodes << " time "
-                  << static_cast<int>(elapsed.count() * 1000) << " nps "
-                  << static_cast<int>(nodes / elapsed.count()) << std::endl;
+                  << static_cast<std::uint64_t>(elapsed.count() * 1000)
+                  << " nps "
+                  << static_cast<std::uint64_t>(nodes / elapsed.count())
+                  << std::endl;
     }
 
     std::cout << "nodes " << nodes << std::endl;
 }
+
+// perftsuite <epdfile> [depth N] [threads N] [split P]
+// The EPD operations give the expected counts, as in ";D1 20 ;D2 400".
+void perftsuite(std::stringstream& ss) {
+    std::string path;
+    if (!(ss >> path)) {
+        return;
+    }
+
+    int max_depth = MAX_PLY;
+    int threads = 0;
+    int split = PERFT_SPLIT_DEFAULT;
+    std::string word;
+    while (ss >> word) {
+        if (word == "depth") {
+            ss >> max_depth;
+        } else {
+            perft_options(word, ss, threads, split);
+        }
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        std::cout << "info string could not open " << path << std::endl;
+        return;
+    }
+    if (threads && !perft_hash_ready()) {
+        return;
+    }
+
+    int positions = 0, failed = 0;
+    std::uint64_t total_nodes = 0;
+    std::int64_t total_time = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string fen, ops;
+        if (!epd_to_fen(line, fen, ops)) {
+            continue;
+        }
+
+        Position pos;
+        parse_fen_to_position(fen.c_str(), pos);
+        ++positions;
+
+        // Check each expected count up to the depth limit.
+        bool passed = true;
+        std::uint64_t nodes = 0;
+        std::int64_t start = now();
+        for (std::size_t i = 0; (i = ops.find(";D", i)) != std::string::npos;
+             ++i) {
+            std::istringstream op(ops.substr(i + 2));
+            int depth = 0;
+            std::uint64_t expected = 0;
+            if (!(op >> depth >> expected) || depth < 1 ||
+                depth > max_depth) {
+                continue;
+            }
+
+            const std::uint64_t count =
+                perft_count(pos, depth, "", threads, split);
+            nodes += count;
+
+            if (count != expected) {
+                passed = false;
+                std::cout << "info string position " << positions
+                          << " depth " << depth << " nodes " << count
+                          << " expected " << expected << " " << fen
+                          << std::endl;
+            }
+        }
+        std::int64_t elapsed = now() - start;
+
+        std::cout << "info string position " << positions << " nodes "
+                  << nodes << " time " << elapsed << " nps "
+                  << nodes * 1000 / (elapsed ? elapsed : 1) << " "
+                  << (passed ? "passed" : "failed") << std::endl;
+
+        failed += !passed;
+        total_nodes += nodes;
+        total_time += elapsed;
+    }
+
+    std::cout << "info string " << positions - failed << " of " << positions
+              << " positions passed, nodes " << total_nodes << " time "
+              << total_time << " nps "
+              << total_nodes * 1000 / (total_time ? total_time : 1)
+              << std::endl;
+}
+
+// analyse <epdfile> [depth N] [nodes N] [movetime N] [threads T]
+//         [tt private|shared] [output <file>]
+void analyse(std::stringstream& ss) {
+    std::string path;
+    if (!(ss >> path)) {
+        return;
+    }
+
+    AnalyseOptions options = {};
+    options.threads = 1;
+    options.megabytes = hash_megabytes;
+    std::string out_path = path + ".out";
+
+    std::string word;
+    while (ss >> word) {
+        if (word == "depth") {
+            ss >> options.depth;
+        } else if (word == "nodes") {
+            ss >> options.nodes;
+        } else if (word == "movetime") {
+            ss >> options.movetime;
+        } else if (word == "threads") {
+            ss >> options.threads;
+        } else if (word == "tt") {
+            ss >> word;
+            options.shared_tt = word == "shared";
+        } else if (word == "output") {
+            ss >> out_path;
+        }
+    }
+
+    if (!options.depth && !options.nodes && options.movetime <= 0) {
+        std::cout << "info string analyse needs a depth, nodes or movetime"
+                  << std::endl;
+        return;
+    }
+    if (options.threads < 1) {
+        options.threads = 1;
+    }
+    if (options.movetime < 0) {
+        options.movetime = 0;
+    }
+
+    std::size_t count = 0;
+    std::int64_t start = now();
+    if (!::analyse(path.c_str(), out_path.c_str(), options, &tt, count)) {
+        std::cout << "info string could not analyse " << path << std::endl;
+        return;
+    }
+
+    std::cout << "info string analysed " << count << " positions in "
+              << now() - start << " ms to " << out_path << std::endl;
+}
+
+// evalbatch <epdfile>
+// Check the batch evaluator against evaluate() and compare their speeds.
+void evalbatch(std::stringstream& ss) {
+    std::string path;
+    if (!(ss >> path)) {
+        return;
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        std::cout << "info string could not open " << path << std::endl;
+        return;
+    }
+
+    std::vector<Position> positions;
+    std::string line, fen, ops;
+    while (std::getline(in, line)) {
+        if (epd_to_fen(line, fen, ops)) {
+            positions.emplace_back();
+            parse_fen_to_position(fen.c_str(), positions.back());
+        }
+    }
+
+    EvalBatch batch;
+    eval_batch_clear(batch);
+    for (const Position& pos : positions) {
+        eval_batch_add(batch, pos);
+    }
+
+    std::vector<int> expected(positions.size()), scores(positions.size());
+    std::int64_t start = now();
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        expected[i] = evaluate(positions[i]);
+    }
+    const std::int64_t single_time = now() - start;
+
+    start = now();
+    evaluate_batch(batch, scores.data());
+    const std::int64_t batch_time = now() - start;
+
+    std::cout << "info string " << positions.size() << " positions, "
+              << single_time << " ms one at a time, " << batch_time
+              << " ms batched, " << eval_batch_check(batch, expected)
+              << " differing scores" << std::endl;
+}
+
+// tune <dataset> [epochs N] [threads T] [rate R] [resolve]
+//      [output <file>]
+void tune(std::stringstream& ss) {
+    std::string path;
+    if (!(ss >> path)) {
+        return;
+    }
+
+    TuneOptions options = {};
+    options.epochs = TUNE_EPOCHS_DEFAULT;
+    options.threads = 1;
+    options.rate = TUNE_RATE_DEFAULT;
+    std::string out_path = "psqt.h";
+
+    std::string word;
+    while (ss >> word) {
+        if (word == "epochs") {
+            ss >> options.epochs;
+        } else if (word == "threads") {
+            ss >> options.threads;
+        } else if (word == "rate") {
+            ss >> options.rate;
+        } else if (word == "resolve") {
+            options.resolve = true;
+        } else if (word == "output") {
+            ss >> out_path;
+        }
+    }
+
+    if (options.threads < 1) {
+        options.threads = 1;
+    }
+
+    TuneResult result;
+    std::int64_t start = now();
+    if (!::tune(path.c_str(), out_path.c_str(), options, result)) {
+        std::cout << "info string could not tune on " << path << std::endl;
+        return;
+    }
+
+    std::cout << "info string tuned on " << result.positions
+              << " positions in " << now() - start << " ms, k " << result.k
+              << " error " << result.start_error << " to " << result.end_error
+              << ", wrote " << out_path << std::endl;
+}
+
+void savehash(std::stringstream& ss) {
+    std::string path;
+    if (!(ss >> path)) {
+        return;
+    }
+
+    tt_wait(&tt);
+
+    if (tt_save(&tt, path.c_str(), key_fingerprint())) {
+        std::cout << "info string saved hash to " << path << std::endl;
+    } else {
+        std::cout << "info string could not save hash to " << path
+                  << std::endl;
+    }
+}
+
+void loadhash(std::stringstream& ss) {
+    std::string path;
+    if (!(ss >> path)) {
+        return;
+    }
+
+    if (tt_load(&tt, path.c_str(), key_fingerprint())) {
+        std::cout << "info string loaded hash from " << path << std::endl;
+    } else {
+        std::cout << "info string could not load hash from " << path
+                  << std::endl;
+    }
+}
 }  // namespace Extension
 
 void ucinewgame() {
     parse_fen_to_position(
         "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", sc.pos);
-    tt_clear(&sc.tt);
+    history_reset(sc.history, sc.pos);
+    tt_new_game(&tt);
 }
 
-void isready() { std::cout << "readyok" << std::endl; }
+void isready() {
+    tt_wait(&tt);
+    std::cout << "readyok" << std::endl;
+}
 
 // setoption name Some Name value Some Value
 void setoption(std::stringstream& ss) {
@@ -122,15 +535,62 @@ void setoption(std::stringstream& ss) {
     }
 
     // Set the option
-    if (name != "" && value != "") {
-        // TODO:
-        // Set the option if found
+    if (name == "Hash") {
+        std::uint64_t megabytes = std::strtoull(value.c_str(), nullptr, 10);
+        if (megabytes < 1) {
+            return;
+        } else if (megabytes > HASH_MAX_MB) {
+            megabytes = HASH_MAX_MB;
+        }
+
+        hash_megabytes = megabytes;
+
+        // Before the first isready the table is created with the final size.
+        if (tt.data) {
+            tt_free(&tt);
+            if (!tt_create(&tt, hash_megabytes)) {
+                std::cout << "info string could not allocate " << value
+                          << " MB of hash" << std::endl;
+                hash_megabytes = HASH_DEFAULT_MB;
+                tt_create(&tt, hash_megabytes);
+            }
+        }
+    } else if (name == "PerftHash") {
+        std::uint64_t megabytes = std::strtoull(value.c_str(), nullptr, 10);
+        if (megabytes < 1) {
+            return;
+        } else if (megabytes > HASH_MAX_MB) {
+            megabytes = HASH_MAX_MB;
+        }
+
+        perft_hash_megabytes = megabytes;
+        perft_tt_free(&ptt);
+    } else if (name == "BookFile") {
+        book_close(&book);
+        if (value != "" && value != "<empty>" &&
+            !book_open(&book, value.c_str())) {
+            std::cout << "info string could not open book " << value
+                      << std::endl;
+        }
+    } else if (name == "EvalFile") {
+        if (value == "" || value == "<empty>") {
+            nnue_unload();
+        } else if (!nnue_load(value.c_str())) {
+            std::cout << "info string could not load network " << value
+                      << std::endl;
+        }
+
+        // The cached evals may be from the other evaluation.
+        std::fill(sc.evals.entries.begin(), sc.evals.entries.end(), 0);
     }
 }
 
 void go(std::stringstream& ss) {
     sc.max_depth = MAX_PLY;
     sc.moves_per_session = 0;
+    sc.max_nodes = 0;
+    sc.infinite = false;
+    sc.silent = false;
     sc.increment = 0;
     sc.search_start_time = 0;
     sc.search_end_time = 0;
@@ -140,10 +600,13 @@ void go(std::stringstream& ss) {
     int btime = -1;
     int winc = -1;
     int binc = -1;
+    int mate = 0;
 
     std::string word;
     while (ss >> word) {
-        if (word == "wtime") {
+        if (word == "infinite") {
+            sc.infinite = true;
+        } else if (word == "wtime") {
             ss >> wtime;
         } else if (word == "btime") {
             ss >> btime;
@@ -155,12 +618,28 @@ void go(std::stringstream& ss) {
             ss >> sc.max_depth;
         } else if (word == "movetime") {
             ss >> sc.movetime;
+        } else if (word == "nodes") {
+            ss >> sc.max_nodes;
         } else if (word == "movestogo") {
             ss >> sc.moves_per_session;
+        } else if (word == "mate") {
+            ss >> mate;
         }
     }
 
-    if (sc.pos.flipped) {
+    // Only play from the book in timed games, not when analysing or when
+    // the search is limited some other way.
+    const bool limited =
+        sc.infinite || sc.max_depth != MAX_PLY || sc.max_nodes || mate;
+    Move book_move;
+    if (!limited && book_probe(&book, sc.pos, book_move)) {
+        char move_str[6];
+        move_to_lan(move_str, book_move);
+        std::cout << "bestmove " << move_str << std::endl;
+        return;
+    }
+
+    if (sc.pos.side == BLACK) {
         sc.our_clock = btime;
         sc.increment = binc;
     } else {
@@ -168,8 +647,10 @@ void go(std::stringstream& ss) {
         sc.increment = winc;
     }
 
-    std::thread search(start_search, std::ref(sc));
-    search.detach();
+    tt_wait(&tt);
+
+    sc.stopped = false;
+    search_thread = std::thread(start_search, std::ref(sc));
 }
 
 void moves(std::stringstream& ss) {
@@ -180,14 +661,8 @@ void moves(std::stringstream& ss) {
             return;
         }
 
-        char move_str[5];
-        move_to_lan(move_str, move);
-
-        if (sc.pos.flipped) {
-            move = flip_move(move);
-        }
-
         make_move(sc.pos, move);
+        history_push(sc.history, sc.pos);
     }
 }
 
@@ -208,15 +683,27 @@ void position(std::stringstream& ss) {
 
     if (fen != "") {
         parse_fen_to_position(fen.c_str(), sc.pos);
+        history_reset(sc.history, sc.pos);
     }
 
     moves(ss);
 }
 
 void listen() {
+    sc.tt = &tt;
+
     std::cout << "id name Monochrome" << std::endl;
     std::cout << "id author flok Gikoskos kz04px mkchan ZirconiumX"
               << std::endl;
+    std::cout << "option name Hash type spin default " << HASH_DEFAULT_MB
+              << " min 1 max " << HASH_MAX_MB << std::endl;
+    std::cout << "option name PerftHash type spin default "
+              << PERFT_HASH_DEFAULT_MB << " min 1 max " << HASH_MAX_MB
+              << std::endl;
+    std::cout << "option name BookFile type string default <empty>"
+              << std::endl;
+    std::cout << "option name EvalFile type string default <empty>"
+              << std::endl;
     std::cout << "uciok" << std::endl;
 
     std::string word;
@@ -236,7 +723,12 @@ void listen() {
         }
     }
 
-    tt_create(&sc.tt, 128);
+    if (!tt_create(&tt, hash_megabytes)) {
+        std::cout << "info string could not allocate " << hash_megabytes
+                  << " MB of hash" << std::endl;
+        hash_megabytes = HASH_DEFAULT_MB;
+        tt_create(&tt, hash_megabytes);
+    }
     ucinewgame();
 
     bool quit = false;
@@ -245,10 +737,19 @@ void listen() {
         std::stringstream ss{line};
         ss >> word;
 
+        // Only isready may run alongside a search. Other commands, stop
+        // and quit included, read or change the position and tables the
+        // search is using, so it finishes first.
+        if (word != "isready") {
+            stop();
+        }
+
         if (word == "isready") {
             isready();
         } else if (word == "ucinewgame") {
             ucinewgame();
+        } else if (word == "setoption") {
+            setoption(ss);
         } else if (word == "position") {
             position(ss);
         } else if (word == "go") {
@@ -259,11 +760,26 @@ void listen() {
             Extension::perft(ss);
         } else if (word == "ttperft") {
             Extension::ttperft(ss);
+        } else if (word == "perftsuite") {
+            Extension::perftsuite(ss);
+        } else if (word == "analyse") {
+            Extension::analyse(ss);
+        } else if (word == "tune") {
+            Extension::tune(ss);
+        } else if (word == "evalbatch") {
+            Extension::evalbatch(ss);
+        } else if (word == "savehash") {
+            Extension::savehash(ss);
+        } else if (word == "loadhash") {
+            Extension::loadhash(ss);
         } else if (word == "moves") {
             moves(ss);
         } else if (word == "quit") {
             quit = true;
         }
     }
+
+    // The table's cleaner thread must finish before the table is destroyed.
+    tt_wait(&tt);
 }
 }  // namespace UCI